@@ -0,0 +1,256 @@
+// Copyright 2015 Marvin Poul
+// Licensed under the Do What The Fuck You Want To License, Version 2
+// See LICENSE for details or http://www.wtfpl.net/txt/copying
+
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cellhack/cellhack.h"
+#include "cellhack/player.h"
+#include "cellhack/save.h"
+
+#define usage() fprintf (stderr, "USAGE: bench [-j threads] [-q] [scenario …]")
+
+/* One fixed game, every run of it plays out the same */
+typedef struct {
+    const char *name;
+    int width;
+    int height;
+    int players;
+    int turns;
+    // share of the field that is filled with cells of random players before
+    // the first turn
+    double fill;
+    // microseconds of CPU time every player may use per turn, 0 for no limit
+    unsigned long budget;
+    // player 0 runs bot_slow instead of bot_mixed
+    int slow;
+    // write a replay of every turn
+    int replay;
+} Scenario;
+
+static const Scenario scenarios [] = {
+    {"empty",    2048, 2048,   2, 200, 0.0,  0,    0, 0},
+    {"dense",     512,  512,   4,  50, 1.0,  0,    0, 0},
+    {"players",  1024, 1024, 254,  30, 0.5,  0,    0, 0},
+    {"timeout",   256,  256,   2,  20, 0.5,  2000, 1, 0},
+    {"replay",   1024, 1024,   4,  50, 0.7,  0,    0, 1},
+};
+
+#define NUM_SCENARIOS (sizeof (scenarios) / sizeof (scenarios [0]))
+
+typedef struct {
+    double seconds;
+    uint64_t ticks;
+    // decisions asked for, i.e. live cells summed over all ticks
+    uint64_t cells;
+    // replay bytes written, 0 without replay
+    uint64_t bytes;
+    // time of every phase summed over all ticks, profiled runs only
+    uint64_t phases [PROFILE_PHASES];
+} Result;
+
+/* Pseudo random but deterministic mix of actions, including moves and splits
+ * that compete for targets */
+static uint8_t
+bot_mixed (uint8_t *env, uint8_t energy, uint64_t *memory)
+{
+    uint64_t h = *memory += 0x9e3779b97f4a7c15ull;
+    uint8_t dir;
+
+    h ^= env [UP] | env [LEFT] << 8 | env [RIGHT] << 16 | (uint64_t) env [DOWN] << 24
+         | (uint64_t) energy << 32;
+    h *= 0xbf58476d1ce4e5b9ull;
+    h ^= h >> 29;
+    dir = 1 + 2 * (h & 3);
+
+    switch ((h >> 8) & 3) {
+        case 0:  return EAT_BASE + dir;
+        case 1:  return MOVE_BASE + dir;
+        case 2:  return energy > ENERGY_MIN_SPLIT ? SPLIT_BASE + dir : REST;
+        default: return REST;
+    }
+}
+
+/* Burns 20 µs of CPU time per cell, so that it runs out of time every turn */
+static uint8_t
+bot_slow (uint8_t *env, uint8_t energy, uint64_t *memory)
+{
+    uint64_t end = Profile_now () + 20000;
+
+    while (Profile_now () < end);
+    return bot_mixed (env, energy, memory);
+}
+
+/* Places cells of random players on fill of the field, next to those that
+ * CellHack_init_config put there */
+static void
+bench_fill (GameState *gs, double fill, Rng *rng)
+{
+    unsigned int idx, cells = Cellhack_width (gs) * Cellhack_height (gs);
+    uint64_t threshold = (uint64_t) (fill * 4294967296.0);
+
+    for (idx = 0; idx < cells; idx++) {
+        if (gs->type [idx] != 0 || (Rng_next (rng) >> 32) >= threshold) continue;
+
+        gs->type [idx]   = 1 + Rng_below (rng, gs->num);
+        gs->energy [idx] = ENERGY_START;
+    }
+    CellHack_recount (gs);
+}
+
+/* Plays sc once
+ * returns 0 on success, 1 on error */
+static int
+bench_run (const Scenario *sc, int threads, int profile, int quick, Result *r)
+{
+    CellHack_decide_action ais [sc->players];
+    char *names [sc->players];
+    char name_buf [sc->players][12];
+    char path [] = "/tmp/cellhack-bench-XXXXXX";
+    int n, fd = -1, err, turns = quick ? (sc->turns + 9) / 10 : sc->turns;
+    int width = quick ? sc->width / 4 : sc->width;
+    int height = quick ? sc->height / 4 : sc->height;
+    GameState *gs = NULL;
+    Save *save = NULL;
+    FILE *file = NULL;
+    struct stat st;
+    uint64_t start;
+    Rng rng;
+    CellHackConfig config = {
+        .threads = threads,
+        .standby = 1,
+        .budget  = sc->budget,
+        .timeout = 1,
+        .seed    = 1,
+        .profile = profile
+    };
+
+    memset (r, 0, sizeof (Result));
+    for (n = 0; n < sc->players; n++) {
+        ais [n] = (sc->slow && n == 0) ? bot_slow : bot_mixed;
+        snprintf (name_buf [n], sizeof (name_buf [n]), "p%i", n);
+        names [n] = name_buf [n];
+    }
+
+    gs = CellHack_init_config (width, height, sc->players, ais, names, &config);
+    check (gs != NULL, "Failed to init scenario %s.", sc->name);
+    Rng_seed (&rng, 2);
+    bench_fill (gs, sc->fill, &rng);
+
+    if (sc->replay) {
+        fd = mkstemp (path);
+        check (fd >= 0, "Failed to create replay file.");
+        file = fdopen (fd, "w");
+        check (file != NULL, "Failed to open replay file.");
+        fd = -1;
+    }
+
+    start = Profile_now ();
+    if (file) {
+        save = Save_create (file, width, height, sc->players, names, NULL);
+        file = NULL;
+        check (save != NULL, "Failed to start replay.");
+    }
+    while (Cellhack_turns (gs) < turns) {
+        CellHack_tick (gs);
+        r->cells += gs->live_cells;
+        if (save) {
+            err = Save_frame (save, Cellhack_types (gs), Cellhack_energies (gs),
+                              Cellhack_memories (gs));
+            check (err == 0, "Failed to save turn %i.", Cellhack_turns (gs));
+        }
+    }
+    if (save) {
+        err = Save_destroy (save);
+        save = NULL;
+        check (err == 0, "Failed to finish replay.");
+    }
+    r->seconds = (Profile_now () - start) / 1e9;
+    r->ticks   = turns;
+
+    if (sc->replay) {
+        err = stat (path, &st);
+        check (err == 0, "Failed to get size of replay.");
+        r->bytes = st.st_size;
+    }
+    for (n = 0; n < PROFILE_PHASES && CellHack_profile (gs); n++) {
+        r->phases [n] = CellHack_profile (gs)->phases [n].total;
+    }
+
+    if (sc->replay) unlink (path);
+    CellHack_destroy (gs);
+    return 0;
+
+error:
+    if (save) Save_destroy (save);
+    if (file) fclose (file);
+    if (fd >= 0) close (fd);
+    if (sc->replay) unlink (path);
+    if (gs) CellHack_destroy (gs);
+    return 1;
+}
+
+/* Prints the results of sc as one line of JSON, the phases come from a
+ * profiled run of their own since timing every call slows the game down */
+static void
+bench_print (const Scenario *sc, int threads, const Result *r, const Result *profiled)
+{
+    int n;
+
+    printf ("{\"scenario\": \"%s\", \"threads\": %i, \"ticks\": %llu, \"cells\": %llu, "
+            "\"seconds\": %.6f, \"ticks_per_s\": %.3f, \"decisions_per_s\": %.1f, "
+            "\"ns_per_cell\": {", sc->name, threads, (unsigned long long) r->ticks,
+            (unsigned long long) r->cells, r->seconds, r->ticks / r->seconds,
+            r->cells / r->seconds);
+    for (n = 0; n < PROFILE_PHASES; n++) {
+        printf ("%s\"%s\": %.3f", n ? ", " : "", Profile_phase_names [n],
+                profiled->cells ? (double) profiled->phases [n] / profiled->cells : 0.0);
+    }
+    printf ("}");
+    if (sc->replay) {
+        printf (", \"replay_mb_per_s\": %.3f, \"replay_bytes\": %llu",
+                r->bytes / r->seconds / 1e6, (unsigned long long) r->bytes);
+    }
+    printf ("}\n");
+    fflush (stdout);
+}
+
+int
+main (int argc, char **argv)
+{
+    int opt, err, threads = 1, quick = 0, i;
+    unsigned int s;
+    Result r, profiled;
+
+    while ((opt = getopt (argc, argv, "j:q")) != -1) {
+        switch (opt) {
+            case 'j':
+                threads = atoi (optarg);
+                break;
+            case 'q':
+                quick = 1;
+                break;
+            default:
+                usage ();
+                return 1;
+        }
+    }
+
+    for (s = 0; s < NUM_SCENARIOS; s++) {
+        for (i = optind; i < argc && strcmp (argv [i], scenarios [s].name) != 0; i++);
+        if (optind < argc && i == argc) continue;
+
+        err = bench_run (scenarios + s, threads, 0, quick, &r);
+        check (err == 0, "Failed to run scenario %s.", scenarios [s].name);
+        err = bench_run (scenarios + s, threads, 1, quick, &profiled);
+        check (err == 0, "Failed to profile scenario %s.", scenarios [s].name);
+        bench_print (scenarios + s, threads, &r, &profiled);
+    }
+
+    return 0;
+
+error:
+    return 1;
+}
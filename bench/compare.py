@@ -0,0 +1,46 @@
+#!/usr/bin/env python3
+import json
+import sys
+
+# higher is better for these, lower for everything in ns_per_cell
+RATES = ["ticks_per_s", "decisions_per_s", "replay_mb_per_s"]
+
+def load (path):
+    runs = {}
+    with open (path) as f:
+        for line in f:
+            if not line.strip (): continue
+            run = json.loads (line)
+            runs [(run ["scenario"], run ["threads"])] = run
+    return runs
+
+def metrics (run):
+    for k in RATES:
+        if k in run: yield k, run [k], 1
+    for k, v in run.get ("ns_per_cell", {}).items ():
+        yield "ns_per_cell." + k, v, -1
+
+def main (argv):
+    if len (argv) != 3:
+        print ("USAGE: compare.py baseline.json new.json", file = sys.stderr)
+        return 1
+
+    old, new = load (argv [1]), load (argv [2])
+    print ("{:<10} {:>2} {:<22} {:>14} {:>14} {:>8}".format (
+           "scenario", "j", "metric", "baseline", "new", "change"))
+    for key in sorted (old.keys () & new.keys ()):
+        now = dict ((k, v) for k, v, _ in metrics (new [key]))
+        for k, v, better in metrics (old [key]):
+            if k not in now: continue
+            change = (now [k] - v) / v * 100 if v else 0.0
+            # mark changes for the worse
+            mark = " !" if change * better < -5 else ""
+            print ("{:<10} {:>2} {:<22} {:>14.3f} {:>14.3f} {:>+7.1f}%{}".format (
+                   key [0], key [1], k, v, now [k], change, mark))
+    for key in sorted (old.keys () ^ new.keys ()):
+        print ("{} with {} threads only in {}".format (key [0], key [1],
+               argv [1] if key in old else argv [2]), file = sys.stderr)
+    return 0
+
+if __name__ == "__main__":
+    sys.exit (main (sys.argv))
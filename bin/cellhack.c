@@ -3,115 +3,233 @@
 // See LICENSE for details or http://www.wtfpl.net/txt/copying
 
 #include <dlfcn.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
 
 #ifndef HEADLESS
 #include <SDL2/SDL.h>
 #endif
 
 #include "cellhack/cellhack.h"
+#include "cellhack/checkpoint.h"
+#include "cellhack/framebuf.h"
+#include "cellhack/json.h"
+#include "cellhack/palette.h"
+#include "cellhack/save.h"
 
-#define usage() fprintf (stderr, "USAGE: cellhack turns width height replay_file player_name path_to_ai_so … …")
+#define usage() fprintf (stderr, "USAGE: cellhack [-j threads] [-b budget_us] [-s] [-H] [-r seed] [-F replay_version] [-f tem] [-k keyframe_interval] [-w write_buffers] [-e stop_conditions] [--stats stats_file] [--scores scores_file] [--checkpoint file] [--checkpoint-every turns] [--restore file] [--window widthxheight] [--fps fps] [--vsync] turns width height replay_file player_name path_to_ai_so … …")
+
+/* Settings of the game window */
+typedef struct {
+    // size of the window in pixels, the field is scaled to fit into it
+    int width;
+    int height;
+    // frames shown per second at most, 0 for as many as the game plays
+    int fps;
+    // wait for the display's vertical sync before showing a frame
+    int vsync;
+} GfxOptions;
+
+/* State shared by the thread playing the game and the window */
+typedef struct {
+    GameState *gs;
+    Save *save;
+    // turn to play up to
+    int turns;
+    // NULL for no checkpoints, otherwise written every checkpoint_every turns
+    // (if that is not 0) and once the game stops
+    const char *checkpoint_path;
+    int checkpoint_every;
+    // NULL without a window, otherwise every turn is published to it
+    FrameBuffer *frames;
+    // NULL or where the scores of every turn are written to
+    FILE *scores;
+    // set by the window: stop playing, pause, turns to play one by one while
+    // paused and turns per second at most, 0 for no limit
+    int quit;
+    int paused;
+    int steps;
+    int speed;
+    // set once the game stopped, failed if it stopped because of an error
+    int done;
+    int failed;
+} Simulation;
 
 #ifndef HEADLESS
 typedef struct {
     SDL_Window *window;
     SDL_Renderer *renderer;
+    // one texel per cell, scaled to the window by the renderer
+    SDL_Texture *texture;
+    // size of the game field in cells
     int width;
     int height;
-    int cell_width;
-    int cell_height;
-    uint8_t *colors;
+    // texel of every cell, indexed by type << 8 | energy
+    uint32_t *shades;
+    // milliseconds per frame, 0 for no limit, and when the next one is due
+    uint32_t frame_ms;
+    uint32_t next_frame;
 } VideoState;
 
+void gfx_display_destroy (VideoState *vs);
+
 /* Initialize graphics stuff
  * num      number of players in the game
  * width    width of the game field in cells
  * height   height of the game field in cells
+ * options  size of the window and frame pacing
  */
 VideoState *
-gfx_display_init (int num, int width, int height)
+gfx_display_init (int num, int width, int height, const GfxOptions *options)
 {
     VideoState *vs = NULL;
-    int err = 0, i, n;
+    Palette *palette = NULL;
+    uint8_t rgb [3];
+    int err = 0, i;
 
     vs = calloc (1, sizeof (VideoState));
     check (vs != NULL, "Failed to alloc video state.");
-    vs->colors = calloc (3 * num, sizeof (uint8_t));
-    check (vs->colors != NULL, "Failed alloc colors array.");
-
-    // TODO: make window size configurable
-    vs->width       = 800;
-    vs->height      = 600;
-    vs->cell_width  = vs->width / width;
-    vs->cell_height = vs->height / height;
-
-    for (i = 0; i < num; i++) {
-        for (n = 0; n < 3; n++) {
-            vs->colors [i + num * n] = rand () % 256;
-        }
+    vs->width    = width;
+    vs->height   = height;
+    vs->frame_ms = options->fps > 0 ? 1000 / options->fps : 0;
+
+    // every combination of type and energy is looked up instead of blended
+    // anew for every cell of every frame
+    palette = Palette_create (num);
+    check (palette != NULL, "Failed to create palette.");
+    vs->shades = calloc (1 << 16, sizeof (uint32_t));
+    check (vs->shades != NULL, "Failed to alloc shades.");
+    for (i = 0; i < 1 << 16; i++) {
+        Palette_shade (palette, i >> 8, i & 0xff, rgb);
+        vs->shades [i] = 0xff000000u | rgb [0] << 16 | rgb [1] << 8 | rgb [2];
     }
-
-    err = SDL_CreateWindowAndRenderer (vs->width, vs->height, 0,
-                                       &(vs->window), &(vs->renderer));
-    check (err == 0, "Failed to create window and renderer.");
-
+    Palette_destroy (palette);
+    palette = NULL;
+
+    vs->window = SDL_CreateWindow ("cellhack", SDL_WINDOWPOS_UNDEFINED,
+                                   SDL_WINDOWPOS_UNDEFINED, options->width,
+                                   options->height, SDL_WINDOW_RESIZABLE);
+    check (vs->window != NULL, "Failed to create window: %s", SDL_GetError ());
+    vs->renderer = SDL_CreateRenderer (vs->window, -1,
+                                       options->vsync ? SDL_RENDERER_PRESENTVSYNC : 0);
+    check (vs->renderer != NULL, "Failed to create renderer: %s", SDL_GetError ());
+
+    // scale cells to blocks of pixels instead of blurring them, keep their
+    // aspect ratio when the window has another one
+    SDL_SetHint (SDL_HINT_RENDER_SCALE_QUALITY, "nearest");
+    err = SDL_RenderSetLogicalSize (vs->renderer, width, height);
+    check (err == 0, "Failed to scale renderer: %s", SDL_GetError ());
+    vs->texture = SDL_CreateTexture (vs->renderer, SDL_PIXELFORMAT_ARGB8888,
+                                     SDL_TEXTUREACCESS_STREAMING, width, height);
+    check (vs->texture != NULL, "Failed to create texture: %s", SDL_GetError ());
+    SDL_SetRenderDrawColor (vs->renderer, PALETTE_BACKGROUND, PALETTE_BACKGROUND,
+                            PALETTE_BACKGROUND, SDL_ALPHA_OPAQUE);
+
+    vs->next_frame = SDL_GetTicks ();
     return vs;
 
 error:
-    if (vs && vs->colors) free (vs->colors);
-    if (vs) free (vs);
+    if (palette) Palette_destroy (palette);
+    gfx_display_destroy (vs);
     return NULL;
 }
 
-/* Update window to show current cells
- * returns 1 on receiving a QuitEvent, 0 otherwise
+/* Update window to show the cells of frame
+ * returns 0 on success, -1 on error
  */
 int
-gfx_display_cells (VideoState *vs, GameState *gs)
+gfx_display_cells (VideoState *vs, const Frame *frame)
 {
-    SDL_Rect rect = {0};
-    SDL_Event event = {0};
-    rect.w = vs->cell_width;
-    rect.h = vs->cell_height;
-    Cell *cell = NULL;
-    int width, height, x, y;
-    uint8_t *colors;
-
-    SDL_SetRenderDrawColor (vs->renderer, 255, 255, 255, SDL_ALPHA_OPAQUE);
-    SDL_RenderClear (vs->renderer);
-
-    SDL_SetRenderDrawColor (vs->renderer, 0, 0, 0, SDL_ALPHA_OPAQUE);
-
-    width = Cellhack_width (gs);
-    height = Cellhack_height (gs);
-    for (x = 0; x < width; x++) {
-        for (y = 0; y < height; y++) {
-            cell = gs->cells + x + y * width;
-            if (cell->type == 0) continue;
-
-            rect.x = x * vs->cell_width;
-            rect.y = y * vs->cell_height;
-
-            colors = vs->colors + (cell->type - 1);
-            SDL_SetRenderDrawColor (vs->renderer, colors [0], colors [1], colors [2],
-                                    cell->energy + 55);
-            SDL_RenderFillRect (vs->renderer, &rect);
+    const uint8_t *types = frame->types, *energies = frame->energies;
+    char title [64];
+    uint32_t *row, now;
+    void *pixels;
+    int pitch, x, y, err;
+    unsigned int idx;
+
+    err = SDL_LockTexture (vs->texture, NULL, &pixels, &pitch);
+    check (err == 0, "Failed to lock texture: %s", SDL_GetError ());
+    for (y = 0, idx = 0; y < vs->height; y++) {
+        row = (uint32_t *) ((uint8_t *) pixels + y * pitch);
+        for (x = 0; x < vs->width; x++, idx++) {
+            row [x] = vs->shades [types [idx] << 8 | energies [idx]];
         }
     }
+    SDL_UnlockTexture (vs->texture);
 
+    SDL_RenderClear (vs->renderer);
+    SDL_RenderCopy (vs->renderer, vs->texture, NULL, NULL);
     SDL_RenderPresent (vs->renderer);
+    snprintf (title, sizeof (title), "cellhack: turn %i", frame->turn);
+    SDL_SetWindowTitle (vs->window, title);
+
+    // wait for the rest of the frame's time, a frame that came late moves
+    // the schedule instead of making the next ones hurry
+    if (vs->frame_ms) {
+        now = SDL_GetTicks ();
+        if ((int32_t) (vs->next_frame - now) > 0) SDL_Delay (vs->next_frame - now);
+        else vs->next_frame = now;
+        vs->next_frame += vs->frame_ms;
+    }
+    return 0;
+
+error:
+    return -1;
+}
+
+/* Handles the window's events, space pauses and resumes the game, the right
+ * arrow (or '.') plays one turn while paused, '+' and '-' double and halve
+ * the turns per second
+ * returns 1 on receiving a QuitEvent, 0 otherwise
+ */
+int
+gfx_handle_events (Simulation *sim)
+{
+    SDL_Event event = {0};
+    int speed;
 
     while (SDL_PollEvent (&event)) {
         switch (event.type) {
             case SDL_QUIT:
                 return 1;
                 break;
+            case SDL_KEYDOWN:
+                speed = __atomic_load_n (&sim->speed, __ATOMIC_RELAXED);
+                switch (event.key.keysym.sym) {
+                    case SDLK_SPACE:
+                        __atomic_xor_fetch (&sim->paused, 1, __ATOMIC_RELAXED);
+                        break;
+                    case SDLK_RIGHT:
+                    case SDLK_PERIOD:
+                        __atomic_add_fetch (&sim->steps, 1, __ATOMIC_RELAXED);
+                        break;
+                    case SDLK_PLUS:
+                    case SDLK_EQUALS:
+                    case SDLK_KP_PLUS:
+                        // no limit above 1024 turns per second
+                        speed = speed == 0 || speed >= 1024 ? 0 : 2 * speed;
+                        break;
+                    case SDLK_MINUS:
+                    case SDLK_KP_MINUS:
+                        speed = speed == 0 ? 512 : (speed > 1 ? speed / 2 : 1);
+                        break;
+                    default:
+                        break;
+                }
+                if (speed != __atomic_load_n (&sim->speed, __ATOMIC_RELAXED)) {
+                    __atomic_store_n (&sim->speed, speed, __ATOMIC_RELAXED);
+                    if (speed) log_info ("Playing %i turns per second.", speed);
+                    else log_info ("Playing as fast as possible.");
+                }
+                break;
             default:
                 break;
         }
     }
 
-    SDL_Delay (17);
     return 0;
 }
 
@@ -122,80 +240,92 @@ gfx_display_destroy (VideoState *vs)
 {
     if (vs == NULL) return;
 
-    SDL_DestroyRenderer (vs->renderer);
-    SDL_DestroyWindow (vs->window);
+    if (vs->texture)  SDL_DestroyTexture (vs->texture);
+    if (vs->renderer) SDL_DestroyRenderer (vs->renderer);
+    if (vs->window)   SDL_DestroyWindow (vs->window);
 
+    if (vs->shades) free (vs->shades);
     free (vs);
 }
 #endif
 
-typedef struct __attribute__ ((packed)) {
-    uint8_t player;
-    uint8_t energy;
-    uint64_t memory;
-} SaveFormat;
-
-/* Init saving stuff
- * target_file      where to write the header
- * width, height    size of the playing field
- * max_players      number of players on the field
- * player_names     their names in the order that corresponds to the values of
- *                  Cell.type value (player_names [0] -> Cell.type = 1, …)
- *
- * format:
- *  > width: integer
- *  > height: integer
- *  > players: first_player, second_player, …
- *  > \000
- * this is followed by frames of 2 * width * height bytes for each turn
- * frames are as described in save_cells and SaveFormat and no delimiter is between them
- */
-FILE *
-save_init (FILE *target_file, int width, int height, int max_players, char **player_names)
+/* returns the SAVE_* flags for a string of field letters (t for type, e for
+ * energy, m for memory), -1 if it holds anything else */
+int
+save_parse_fields (const char *letters)
 {
-    int i;
-
-    fprintf (target_file, "width: %i\n", width);
-    fprintf (target_file, "height: %i\n", height);
-    fprintf (target_file, "players: ");
-    for (i = 0; i < max_players - 1; i++) {
-        fprintf (target_file, "%s, ", player_names [i]);
+    int fields = 0;
+
+    for (; *letters; letters++) {
+        switch (*letters) {
+            case 't': fields |= SAVE_TYPE;   break;
+            case 'e': fields |= SAVE_ENERGY; break;
+            case 'm': fields |= SAVE_MEMORY; break;
+            default:  return -1;
+        }
     }
-    fprintf (target_file, "%s\n", player_names [max_players - 1]);
-    fwrite ("\0", 1, sizeof (char), target_file);
 
-    return target_file;
+    return fields;
 }
 
-/* Clean up saving stuff
- */
 void
-save_destroy (FILE *target_file)
+stats_put_hist (FILE *out, const ProfileHist *h)
 {
-    // we could write some footer here, but eh, don't see the need yet
-    fclose (target_file);
+    int b;
+
+    fprintf (out, "{\"count\": %" PRIu64 ", \"total_ns\": %" PRIu64
+             ", \"mean_ns\": %" PRIu64 ", \"max_ns\": %" PRIu64 ", \"log2_ns\": [",
+             h->count, h->total, h->count ? h->total / h->count : 0, h->max);
+    for (b = 0; b < PROFILE_BUCKETS; b++) {
+        fprintf (out, "%s%" PRIu64, b ? ", " : "", h->hist [b]);
+    }
+    fprintf (out, "]}");
 }
 
-/* Save type and energy of all cells directly into a file
- * target_file  where to write the data (assumes that header data was already
- *              written to that location
- * max_cells    number of cells in the next array
- * cells        pointer to an array of cells to save
- */
+/* Writes the profile of the game as JSON to path, histograms count the
+ * samples of 2^b to 2^(b+1) - 1 ns in their b-th bucket
+ * returns 0 on success, 1 on error */
 int
-save_cells (FILE *target_file, int max_cells, Cell *cells)
+stats_write (const char *path, GameState *gs, Save *save)
 {
-    int i, ret;
-    Cell cell;
-    SaveFormat buf[max_cells];
-    for (i = 0; i < max_cells; i++) {
-        cell = cells [i];
-        buf[i].player = cell.type;
-        buf[i].energy = cell.energy;
-        buf[i].memory = cell.memory;
+    const Profile *profile = CellHack_profile (gs);
+    ProfileHist decisions;
+    uint64_t hits, misses;
+    FILE *out = NULL;
+    int n, err;
+
+    out = fopen (path, "w");
+    check (out != NULL, "Failed to open stats file %s.", path);
+
+    fprintf (out, "{\"turns\": %i, \"width\": %i, \"height\": %i,\n \"phases\": {",
+             Cellhack_turns (gs), Cellhack_width (gs), Cellhack_height (gs));
+    for (n = 0; n < PROFILE_PHASES; n++) {
+        fprintf (out, "%s\n  \"%s\": ", n ? "," : "", Profile_phase_names [n]);
+        stats_put_hist (out, profile->phases + n);
     }
-    ret = fwrite (buf, sizeof (SaveFormat), max_cells, target_file);
-    check (ret == max_cells, "Failed to write cell state to file.");
+    fprintf (out, "},\n \"players\": [");
+    for (n = 0; n < gs->num; n++) {
+        memset (&decisions, 0, sizeof (decisions));
+        CellHack_decision_stats (gs, n, &decisions);
+        CellHack_memo_stats (gs, n, &hits, &misses);
+
+        fprintf (out, "%s\n  {\"name\": ", n ? "," : "");
+        Json_put_string (out, gs->names [n]);
+        fprintf (out, ", \"cells\": %u, \"energy\": %" PRIu64 ", \"births\": %" PRIu64
+                 ", \"deaths\": %" PRIu64 ", \"starvations\": %" PRIu64,
+                 CellHack_population (gs, n), CellHack_energy (gs, n),
+                 CellHack_births (gs, n), CellHack_deaths (gs, n),
+                 CellHack_starvations (gs, n));
+        fprintf (out, ", \"timeouts\": %" PRIu64 ", \"cache_hits\": %" PRIu64
+                 ", \"cache_misses\": %" PRIu64 ", \"calls\": ",
+                 profile->timeouts [n], hits, misses);
+        stats_put_hist (out, &decisions);
+        fputc ('}', out);
+    }
+    fprintf (out, "],\n \"replay_stall_ns\": %" PRIu64 "}\n", Save_stall (save));
+
+    err = ferror (out) | fclose (out);
+    check (err == 0, "Failed to write stats file %s.", path);
 
     return 0;
 
@@ -203,17 +333,260 @@ error:
     return 1;
 }
 
+/* Writes the scores of the current turn as one line of JSON to out, taken
+ * from the counts the game keeps, so it costs nothing per cell
+ * returns 0 on success, 1 on error */
+int
+scores_write (FILE *out, GameState *gs)
+{
+    int n;
+
+    fprintf (out, "{\"turn\": %i, \"cells\": [", Cellhack_turns (gs));
+    for (n = 0; n < gs->num; n++) {
+        fprintf (out, "%s%u", n ? ", " : "", CellHack_population (gs, n));
+    }
+    fprintf (out, "], \"energy\": [");
+    for (n = 0; n < gs->num; n++) {
+        fprintf (out, "%s%" PRIu64, n ? ", " : "", CellHack_energy (gs, n));
+    }
+    fprintf (out, "], \"births\": [");
+    for (n = 0; n < gs->num; n++) {
+        fprintf (out, "%s%" PRIu64, n ? ", " : "", CellHack_births (gs, n));
+    }
+    fprintf (out, "], \"deaths\": [");
+    for (n = 0; n < gs->num; n++) {
+        fprintf (out, "%s%" PRIu64, n ? ", " : "", CellHack_deaths (gs, n));
+    }
+    fprintf (out, "], \"starvations\": [");
+    for (n = 0; n < gs->num; n++) {
+        fprintf (out, "%s%" PRIu64, n ? ", " : "", CellHack_starvations (gs, n));
+    }
+    fprintf (out, "]}\n");
+
+    return ferror (out) != 0;
+}
+
+/* Copies the current turn to the back frame of sim and publishes it */
+void
+simulate_publish (Simulation *sim)
+{
+    GameState *gs = sim->gs;
+    Frame *frame = FrameBuffer_back (sim->frames);
+    size_t cells = (size_t) Cellhack_width (gs) * Cellhack_height (gs);
+
+    frame->turn = Cellhack_turns (gs);
+    memcpy (frame->types, Cellhack_types (gs), cells);
+    memcpy (frame->energies, Cellhack_energies (gs), cells);
+    FrameBuffer_publish (sim->frames);
+}
+
+/* Plays the game until its last turn, until one of the game's stop conditions
+ * holds or until sim->quit is set, saving and
+ * publishing every turn; runs on a thread of its own if there is a window,
+ * so that the game never waits for it
+ * returns NULL, sim->failed is set on error */
+void *
+simulate (void *arg)
+{
+    Simulation *sim = arg;
+    GameState *gs = sim->gs;
+    struct timespec nap = {0, 1000000}, wait;
+    uint64_t next = Profile_now (), now;
+    int err, speed;
+
+    err = Save_frame (sim->save, Cellhack_types (gs), Cellhack_energies (gs),
+                      Cellhack_memories (gs));
+    check (err == 0, "Failed to save turn %i.", Cellhack_turns (gs));
+    if (sim->frames) simulate_publish (sim);
+    if (sim->scores) {
+        err = scores_write (sim->scores, gs);
+        check (err == 0, "Failed to write scores of turn %i.", Cellhack_turns (gs));
+    }
+
+    while (Cellhack_turns (gs) < sim->turns && !CellHack_stopped (gs)
+           && !__atomic_load_n (&sim->quit, __ATOMIC_RELAXED)) {
+        if (__atomic_load_n (&sim->paused, __ATOMIC_RELAXED)) {
+            next = Profile_now ();
+            if (__atomic_load_n (&sim->steps, __ATOMIC_RELAXED) == 0) {
+                nanosleep (&nap, NULL);
+                continue;
+            }
+            __atomic_sub_fetch (&sim->steps, 1, __ATOMIC_RELAXED);
+        } else if ((speed = __atomic_load_n (&sim->speed, __ATOMIC_RELAXED))) {
+            now = Profile_now ();
+            if (next > now) {
+                wait.tv_sec  = (next - now) / 1000000000;
+                wait.tv_nsec = (next - now) % 1000000000;
+                nanosleep (&wait, NULL);
+            } else {
+                next = now;
+            }
+            next += 1000000000 / speed;
+        }
+
+        CellHack_tick (gs);
+        err = Save_frame (sim->save, Cellhack_types (gs), Cellhack_energies (gs),
+                          Cellhack_memories (gs));
+        check (err == 0, "Failed to save turn %i.", Cellhack_turns (gs));
+        if (sim->frames) simulate_publish (sim);
+        if (sim->scores) {
+            err = scores_write (sim->scores, gs);
+            check (err == 0, "Failed to write scores of turn %i.", Cellhack_turns (gs));
+        }
+
+        if (sim->checkpoint_path && sim->checkpoint_every > 0
+            && Cellhack_turns (gs) % sim->checkpoint_every == 0) {
+            err = CellHack_checkpoint (gs, sim->checkpoint_path);
+            check (err == 0, "Failed to checkpoint turn %i.", Cellhack_turns (gs));
+        }
+    }
+    if (CellHack_stopped (gs)) {
+        log_info ("Game stopped after turn %i: %s.", Cellhack_turns (gs),
+                  CellHack_stop_reason (CellHack_stopped (gs)));
+    }
+    if (sim->checkpoint_path) {
+        err = CellHack_checkpoint (gs, sim->checkpoint_path);
+        check (err == 0, "Failed to checkpoint turn %i.", Cellhack_turns (gs));
+    }
+
+    __atomic_store_n (&sim->done, 1, __ATOMIC_RELEASE);
+    return NULL;
+
+error:
+    sim->failed = 1;
+    __atomic_store_n (&sim->done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
 int
 main (int argc, char** argv)
 {
+    int opt, err;
+    const char *stats_path = NULL, *checkpoint_path = NULL, *restore_path = NULL;
+    const char *scores_path = NULL;
+    int checkpoint_every = 0;
+    struct option long_options [] = {
+        {"stats", required_argument, NULL, 'S'},
+        {"scores", required_argument, NULL, 'O'},
+        {"checkpoint", required_argument, NULL, 'C'},
+        {"checkpoint-every", required_argument, NULL, 'E'},
+        {"restore", required_argument, NULL, 'R'},
+        {"window", required_argument, NULL, 'W'},
+        {"fps", required_argument, NULL, 'P'},
+        {"vsync", no_argument, NULL, 'V'},
+        {0}
+    };
+    SaveOptions save_options = {
+        .version   = 2,
+        .fields    = SAVE_ALL,
+        .keyframes = SAVE_KEYFRAME_INTERVAL,
+        .buffers   = 2
+    };
+    GfxOptions gfx_options = {
+        .width  = 800,
+        .height = 600,
+        .fps    = 60
+    };
+    CellHackConfig config = {
+        .threads = 1,
+        .standby = 1,
+        .budget  = 1000000,
+        .timeout = 1
+    };
+
+    while ((opt = getopt_long (argc, argv, "+j:b:sHr:F:f:k:w:e:", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'j':
+                config.threads = atoi (optarg);
+                break;
+            case 'b':
+                config.budget = strtoul (optarg, NULL, 10);
+                break;
+            case 's':
+                config.sandbox = 1;
+                break;
+            case 'H':
+                config.hugepages = 1;
+                break;
+            case 'r':
+                config.seed = strtoull (optarg, NULL, 0);
+                break;
+            case 'F':
+                save_options.version = atoi (optarg);
+                break;
+            case 'f':
+                save_options.fields = save_parse_fields (optarg);
+                break;
+            case 'k':
+                save_options.keyframes = atoi (optarg);
+                break;
+            case 'w':
+                save_options.buffers = atoi (optarg);
+                break;
+            case 'e':
+                config.stop = CellHack_parse_stop (optarg);
+                if (config.stop < 0) {
+                    usage ();
+                    return 1;
+                }
+                break;
+            case 'S':
+                stats_path = optarg;
+                config.profile = 1;
+                break;
+            case 'O':
+                scores_path = optarg;
+                break;
+            case 'C':
+                checkpoint_path = optarg;
+                break;
+            case 'E':
+                checkpoint_every = atoi (optarg);
+                break;
+            case 'R':
+                restore_path = optarg;
+                break;
+            case 'W':
+                if (sscanf (optarg, "%ix%i", &gfx_options.width, &gfx_options.height) != 2) {
+                    usage ();
+                    return 1;
+                }
+                break;
+            case 'P':
+                gfx_options.fps = atoi (optarg);
+                break;
+            case 'V':
+                gfx_options.vsync = 1;
+                break;
+            default:
+                usage ();
+                return 1;
+        }
+    }
+    // drop the options, so that the positional arguments start at argv [1]
+    argc -= optind - 1;
+    argv += optind - 1;
+
     int i = 0, j, n = (argc - 4) / 2;
-    int surviving_cells [n];
+    unsigned int surviving_cells [n];
     int turns, width, height;
     char* player_names [n];
     void* dlls [n];
     CellHack_decide_action ais [n];
+    CellHack_decide_actions_batch batch_ais [n];
+    int pure [n];
+    const int *flag;
+    uint64_t hits, misses;
     GameState *gs = NULL;
+    Checkpoint *cp = NULL;
     FILE *target_file = NULL;
+    Save *save = NULL;
+    Simulation sim = {0};
+#ifndef HEADLESS
+    VideoState *vs = NULL;
+    pthread_t simulation;
+    int simulating = 0;
+#endif
 
     if (argc < 7 || argc % 2 == 0) {
         usage ();
@@ -232,67 +605,144 @@ main (int argc, char** argv)
         ais [i]   = dlsym (dlls [i], "cell_decide_action");
         check (ais [i] != NULL, "Failed to load ai function for player '%s': %s",
                player_names [i], dlerror ());
+        // optional, the engine falls back to ais [i] without it
+        batch_ais [i] = dlsym (dlls [i], "cell_decide_actions_batch");
+        flag = dlsym (dlls [i], "cell_pure");
+        pure [i] = flag && *flag;
+    }
+    config.batch_ai = batch_ais;
+    config.pure = pure;
+
+    if (restore_path) {
+        cp = Checkpoint_open (restore_path);
+        check (cp != NULL, "Failed to open checkpoint.");
+        check (cp->width == width && cp->height == height && cp->num == n,
+               "Checkpoint is of a %ix%i game of %i players.", cp->width, cp->height,
+               cp->num);
+        for (j = 0; j < n; j++) {
+            if (strcmp (cp->names [j], player_names [j]) == 0) continue;
+            log_info ("Player %s takes over from %s.", player_names [j], cp->names [j]);
+        }
+        gs = CellHack_restore (cp, ais, player_names, &config);
+        Checkpoint_close (cp);
+        cp = NULL;
+    } else {
+        gs = CellHack_init_config (width, height, i, ais, player_names, &config);
     }
-
-    gs = CellHack_init (width, height, i, 1, ais, player_names);
     check (gs != NULL, "Failed to init CellHack.");
 
     target_file = fopen (argv [4], "w");
     check (target_file != NULL, "Failed to open replay file");
-    save_init (target_file, width, height, i, player_names);
+    save = Save_create (target_file, width, height, i, player_names, &save_options);
+    // the file is gone either way
+    target_file = NULL;
+    check (save != NULL, "Failed to start replay.");
+
+    sim.gs    = gs;
+    sim.save  = save;
+    sim.turns = turns;
+    sim.checkpoint_path  = checkpoint_path;
+    sim.checkpoint_every = checkpoint_every;
+    if (scores_path) {
+        sim.scores = fopen (scores_path, "w");
+        check (sim.scores != NULL, "Failed to open scores file %s.", scores_path);
+        // whoever follows the file sees every turn as soon as it is played
+        setvbuf (sim.scores, NULL, _IOLBF, 0);
+    }
 
 #ifndef HEADLESS
-    int ret = 0;
-    VideoState *vs = NULL;
-    vs = gfx_display_init (i, width, height);
-    check (vs != NULL, "Failed to init video state.");
+    const Frame *frame;
+    int done;
 
-    gfx_display_cells (vs, gs);
-#endif
-
-    save_cells (target_file, Cellhack_width (gs) * Cellhack_height(gs), gs->cells);
+    vs = gfx_display_init (i, width, height, &gfx_options);
+    check (vs != NULL, "Failed to init video state.");
+    sim.frames = FrameBuffer_create (width * height);
+    check (sim.frames != NULL, "Failed to create frame buffer.");
+
+    err = pthread_create (&simulation, NULL, simulate, &sim);
+    check (err == 0, "Failed to start simulation thread.");
+    simulating = 1;
+
+    // show the latest turn until the game stopped and its last turn is shown
+    while (1) {
+        done = __atomic_load_n (&sim.done, __ATOMIC_ACQUIRE);
+        frame = FrameBuffer_acquire (sim.frames);
+        if (frame) {
+            err = gfx_display_cells (vs, frame);
+            check (err == 0, "Failed to display turn %i.", frame->turn);
+        } else if (done) {
+            break;
+        } else {
+            SDL_Delay (1);
+        }
 
-    while (Cellhack_turns(gs) < turns) {
-        CellHack_tick (gs);
-#ifndef HEADLESS
-        ret = gfx_display_cells (vs, gs);
-        if (ret == 1) break;
-#endif
-        save_cells (target_file, Cellhack_width (gs) * Cellhack_height(gs), gs->cells);
+        if (gfx_handle_events (&sim)) {
+            __atomic_store_n (&sim.quit, 1, __ATOMIC_RELAXED);
+        }
     }
 
-
-#ifndef HEADLESS
+    pthread_join (simulation, NULL);
+    simulating = 0;
     gfx_display_destroy (vs);
+    vs = NULL;
+#else
+    simulate (&sim);
 #endif
+    check (!sim.failed, "Failed to play the game.");
 
-    for (j = 0; j < n; j++) {
-        surviving_cells [j] = 0;
-    }
-    uint8_t type = 0;
-    for (j = 0; j < Cellhack_width (gs) * Cellhack_height (gs); j++) {
-        type = gs->cells [j].type;
-        if (type != 0) {
-            surviving_cells [type - 1]++;
-        }
+    // as they would be after the last turn if the game ended in extinction
+    // or a cycle, otherwise as they were when it stopped
+    if (CellHack_standings (gs, turns, surviving_cells)) {
+        log_info ("Cells as of turn %i, where the game stopped.", Cellhack_turns (gs));
     }
     printf ("Player: Cells surving\n");
     for (j = 0; j < n; j++) {
-        printf ("%s: %i\n", player_names [j], surviving_cells [j]);
+        printf ("%s: %u\n", player_names [j], surviving_cells [j]);
+    }
+    for (j = 0; j < n; j++) {
+        if (!pure [j]) continue;
+        CellHack_memo_stats (gs, j, &hits, &misses);
+        debug ("Decision cache of %s: %llu hits, %llu misses.", player_names [j],
+               (unsigned long long) hits, (unsigned long long) misses);
+    }
+    if (stats_path) {
+        err = stats_write (stats_path, gs, save);
+        check (err == 0, "Failed to write stats.");
     }
 
     CellHack_destroy (gs);
-    // just for completeness sake, in the future we might decide to write a
-    // footer or not use stdin
-    save_destroy (target_file);
+    gs = NULL;
+    if (sim.frames) FrameBuffer_destroy (sim.frames);
+    sim.frames = NULL;
+    if (sim.scores) {
+        err = fclose (sim.scores);
+        sim.scores = NULL;
+        check (err == 0, "Failed to finish scores file.");
+    }
+    debug ("Replay: %llu bytes written, game waited %.3f s for the writer.",
+           (unsigned long long) Save_bytes (save), Save_stall (save) / 1e9);
+    err = Save_destroy (save);
+    save = NULL;
+    check (err == 0, "Failed to finish replay.");
 
     return 0;
 
 error:
+#ifndef HEADLESS
+    if (simulating) {
+        __atomic_store_n (&sim.quit, 1, __ATOMIC_RELAXED);
+        pthread_join (simulation, NULL);
+    }
+    if (vs) gfx_display_destroy (vs);
+#endif
+    if (sim.frames) FrameBuffer_destroy (sim.frames);
+    if (sim.scores) fclose (sim.scores);
     for (j = 0; j < i; j++) {
         dlclose (dlls [j]);
     }
     if (gs) CellHack_destroy (gs);
+    if (cp) Checkpoint_close (cp);
+    if (save) Save_destroy (save);
     if (target_file) fclose (target_file);
     return 1;
 }
@@ -0,0 +1,110 @@
+#!/usr/bin/env python3
+# Thin ctypes binding to the replay reader in lib/cellhack/replay.h
+#
+# The library is looked up in $CELLHACK_LIB, then in build/libcellhack.so next
+# to this directory.
+import ctypes
+import os
+
+TYPE, ENERGY, MEMORY = 1, 2, 4
+
+class _Replay (ctypes.Structure):
+    # leading fields of Replay, the rest is none of our business
+    _fields_ = [("version", ctypes.c_int),
+                ("width", ctypes.c_int),
+                ("height", ctypes.c_int),
+                ("num", ctypes.c_int),
+                ("fields", ctypes.c_int),
+                ("frames", ctypes.c_uint),
+                ("names", ctypes.POINTER (ctypes.c_char_p))]
+
+def _load ():
+    path = os.environ.get ("CELLHACK_LIB")
+    if not path:
+        path = os.path.join (os.path.dirname (os.path.abspath (__file__)),
+                             "..", "build", "libcellhack.so")
+    lib = ctypes.CDLL (path)
+
+    lib.Replay_open.argtypes = [ctypes.c_char_p]
+    lib.Replay_open.restype = ctypes.POINTER (_Replay)
+    lib.Replay_close.argtypes = [ctypes.POINTER (_Replay)]
+    lib.Replay_close.restype = None
+    lib.ReplayFrame_create.argtypes = [ctypes.POINTER (_Replay)]
+    lib.ReplayFrame_create.restype = ctypes.c_void_p
+    lib.ReplayFrame_destroy.argtypes = [ctypes.c_void_p]
+    lib.ReplayFrame_destroy.restype = None
+    lib.Replay_frame.argtypes = [ctypes.c_void_p, ctypes.c_uint]
+    lib.Replay_frame.restype = ctypes.c_int
+    lib.ReplayFrame_planes.argtypes = [ctypes.c_void_p, ctypes.c_void_p,
+                                       ctypes.c_void_p, ctypes.c_void_p]
+    lib.ReplayFrame_planes.restype = None
+    return lib
+
+_lib = None
+
+def available ():
+    global _lib
+    if _lib is None:
+        try:
+            _lib = _load ()
+        except OSError:
+            _lib = False
+    return bool (_lib)
+
+class Replay:
+    """A replay of either version, frames can be read in any order
+
+    replay [n] returns the planes of frame n as (types, energies, memories),
+    two bytes objects and a list, all of width * height cells in row order."""
+
+    def __init__ (self, path):
+        if not available ():
+            raise OSError ("libcellhack.so not found, set CELLHACK_LIB")
+        self._frame = None
+        self._replay = _lib.Replay_open (os.fsencode (path))
+        if not self._replay:
+            raise OSError ("failed to open replay " + path)
+        self._frame = _lib.ReplayFrame_create (self._replay)
+        if not self._frame:
+            self.close ()
+            raise MemoryError ("failed to create replay frame")
+
+        r = self._replay.contents
+        self.version, self.fields = r.version, r.fields
+        self.width, self.height = r.width, r.height
+        self.players = [r.names [i].decode ("utf8") for i in range (r.num)]
+        self._cells = r.width * r.height
+        self._types = ctypes.create_string_buffer (self._cells)
+        self._energies = ctypes.create_string_buffer (self._cells)
+        self._memories = (ctypes.c_uint64 * self._cells) ()
+
+    def __len__ (self):
+        return self._replay.contents.frames
+
+    def __getitem__ (self, n):
+        if n < 0: n += len (self)
+        if not 0 <= n < len (self):
+            raise IndexError ("replay has no frame %i" % n)
+        if _lib.Replay_frame (self._frame, n) != 0:
+            raise OSError ("failed to read frame %i" % n)
+        _lib.ReplayFrame_planes (self._frame, self._types, self._energies,
+                                 self._memories)
+        return (self._types.raw, self._energies.raw, list (self._memories))
+
+    def __iter__ (self):
+        for n in range (len (self)):
+            yield self [n]
+
+    def close (self):
+        if self._frame:
+            _lib.ReplayFrame_destroy (self._frame)
+            self._frame = None
+        if self._replay:
+            _lib.Replay_close (self._replay)
+            self._replay = None
+
+    def __enter__ (self):
+        return self
+
+    def __exit__ (self, *args):
+        self.close ()
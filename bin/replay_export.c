@@ -0,0 +1,391 @@
+// Copyright 2015 Marvin Poul
+// Licensed under the Do What The Fuck You Want To License, Version 2
+// See LICENSE for details or http://www.wtfpl.net/txt/copying
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "dbg.h"
+#include "cellhack/json.h"
+#include "cellhack/replay.h"
+
+#define usage() fprintf (stderr, "USAGE: replay_export [-o ndjson|csv|columns] [-t first:last] [-r x,y,width,height] [-e] replay_file [output]")
+
+#define EXPORT_NDJSON  0
+#define EXPORT_CSV     1
+#define EXPORT_COLUMNS 2
+
+// one file per column of the columns format, see export_columns_open
+#define EXPORT_TURN   0
+#define EXPORT_X      1
+#define EXPORT_Y      2
+#define EXPORT_PLAYER 3
+#define EXPORT_ENERGY 4
+#define EXPORT_MEMORY 5
+#define EXPORT_NUM_COLUMNS 6
+
+static const char *column_names [EXPORT_NUM_COLUMNS] = {
+    "turn", "x", "y", "player", "energy", "memory"
+};
+static const int column_sizes [EXPORT_NUM_COLUMNS] = {4, 2, 2, 1, 1, 8};
+
+typedef struct {
+    int format;
+    // frames first to last, inclusive
+    unsigned int first;
+    unsigned int last;
+    // region of interest, clipped to the field
+    int x;
+    int y;
+    int width;
+    int height;
+    // skip cells without a player
+    int drop_empty;
+    FILE *out;
+    // output files of the columns format, NULL for the planes not recorded
+    FILE *columns [EXPORT_NUM_COLUMNS];
+    // cells exported so far
+    uint64_t rows;
+} Export;
+
+/* Writes the size lowest bytes of v little endian */
+static void
+put_le (FILE *out, uint64_t v, int size)
+{
+    for (; size > 0; size--, v >>= 8) {
+        fputc (v & 0xff, out);
+    }
+}
+
+static inline const char *
+player_name (const Replay *replay, uint8_t type)
+{
+    if (type == 0 || type > replay->num) return "dead";
+    return replay->names [type - 1];
+}
+
+/* Writes one line holding all exported cells of frame n */
+static void
+export_ndjson (Export *ex, const ReplayFrame *frame, unsigned int n)
+{
+    const Replay *replay = frame->replay;
+    int x, y, first = 1;
+    unsigned int idx;
+    uint8_t type;
+
+    fprintf (ex->out, "{\"turn\":%u,\"cells\":[", n);
+    for (y = ex->y; y < ex->y + ex->height; y++) {
+        for (x = ex->x; x < ex->x + ex->width; x++) {
+            idx = x + y * replay->width;
+            type = ReplayFrame_type (frame, idx);
+            if (ex->drop_empty && type == 0) continue;
+
+            fprintf (ex->out, "%s{\"x\":%i,\"y\":%i", first ? "" : ",", x, y);
+            first = 0;
+            if (replay->fields & SAVE_TYPE) {
+                fputs (",\"player\":", ex->out);
+                Json_put_string (ex->out, player_name (replay, type));
+            }
+            if (replay->fields & SAVE_ENERGY) {
+                fprintf (ex->out, ",\"energy\":%u", ReplayFrame_energy (frame, idx));
+            }
+            if (replay->fields & SAVE_MEMORY) {
+                fprintf (ex->out, ",\"memory\":%" PRIu64, ReplayFrame_memory (frame, idx));
+            }
+            fputc ('}', ex->out);
+            ex->rows++;
+        }
+    }
+    fputs ("]}\n", ex->out);
+}
+
+static void
+export_csv_header (Export *ex, const Replay *replay)
+{
+    fputs ("turn,x,y", ex->out);
+    if (replay->fields & SAVE_TYPE)   fputs (",player", ex->out);
+    if (replay->fields & SAVE_ENERGY) fputs (",energy", ex->out);
+    if (replay->fields & SAVE_MEMORY) fputs (",memory", ex->out);
+    fputc ('\n', ex->out);
+}
+
+/* Writes one row per exported cell of frame n, player names are written as
+ * they are, cellhack does not allow commas in them anyway */
+static void
+export_csv (Export *ex, const ReplayFrame *frame, unsigned int n)
+{
+    const Replay *replay = frame->replay;
+    int x, y;
+    unsigned int idx;
+    uint8_t type;
+
+    for (y = ex->y; y < ex->y + ex->height; y++) {
+        for (x = ex->x; x < ex->x + ex->width; x++) {
+            idx = x + y * replay->width;
+            type = ReplayFrame_type (frame, idx);
+            if (ex->drop_empty && type == 0) continue;
+
+            fprintf (ex->out, "%u,%i,%i", n, x, y);
+            if (replay->fields & SAVE_TYPE) {
+                fprintf (ex->out, ",%s", player_name (replay, type));
+            }
+            if (replay->fields & SAVE_ENERGY) {
+                fprintf (ex->out, ",%u", ReplayFrame_energy (frame, idx));
+            }
+            if (replay->fields & SAVE_MEMORY) {
+                fprintf (ex->out, ",%" PRIu64, ReplayFrame_memory (frame, idx));
+            }
+            fputc ('\n', ex->out);
+            ex->rows++;
+        }
+    }
+}
+
+/* Opens prefix.turn, prefix.x, … for the columns format, each a flat array of
+ * little endian integers of column_sizes bytes; the player column holds cell
+ * types, whose names go to prefix.meta when the export is done
+ * returns 0 on success, 1 on error */
+static int
+export_columns_open (Export *ex, const Replay *replay, const char *prefix)
+{
+    char path [4096];
+    int i, recorded;
+
+    for (i = 0; i < EXPORT_NUM_COLUMNS; i++) {
+        recorded = (i == EXPORT_PLAYER && replay->fields & SAVE_TYPE)
+                   || (i == EXPORT_ENERGY && replay->fields & SAVE_ENERGY)
+                   || (i == EXPORT_MEMORY && replay->fields & SAVE_MEMORY)
+                   || i < EXPORT_PLAYER;
+        if (!recorded) continue;
+
+        snprintf (path, sizeof (path), "%s.%s", prefix, column_names [i]);
+        ex->columns [i] = fopen (path, "wb");
+        check (ex->columns [i] != NULL, "Failed to open %s.", path);
+    }
+
+    return 0;
+
+error:
+    return 1;
+}
+
+static void
+export_columns (Export *ex, const ReplayFrame *frame, unsigned int n)
+{
+    const Replay *replay = frame->replay;
+    FILE **c = ex->columns;
+    int x, y;
+    unsigned int idx;
+    uint8_t type;
+
+    for (y = ex->y; y < ex->y + ex->height; y++) {
+        for (x = ex->x; x < ex->x + ex->width; x++) {
+            idx = x + y * replay->width;
+            type = ReplayFrame_type (frame, idx);
+            if (ex->drop_empty && type == 0) continue;
+
+            put_le (c [EXPORT_TURN], n, column_sizes [EXPORT_TURN]);
+            put_le (c [EXPORT_X], x, column_sizes [EXPORT_X]);
+            put_le (c [EXPORT_Y], y, column_sizes [EXPORT_Y]);
+            if (c [EXPORT_PLAYER]) put_le (c [EXPORT_PLAYER], type, 1);
+            if (c [EXPORT_ENERGY]) {
+                put_le (c [EXPORT_ENERGY], ReplayFrame_energy (frame, idx), 1);
+            }
+            if (c [EXPORT_MEMORY]) {
+                put_le (c [EXPORT_MEMORY], ReplayFrame_memory (frame, idx), 8);
+            }
+            ex->rows++;
+        }
+    }
+}
+
+/* Writes prefix.meta, which describes the columns, and closes them
+ * returns 0 on success, 1 on error */
+static int
+export_columns_close (Export *ex, const Replay *replay, const char *prefix)
+{
+    char path [4096];
+    FILE *meta = NULL;
+    int i, err = 0;
+
+    for (i = 0; i < EXPORT_NUM_COLUMNS; i++) {
+        if (!ex->columns [i]) continue;
+        err |= ferror (ex->columns [i]);
+        err |= fclose (ex->columns [i]);
+        ex->columns [i] = NULL;
+    }
+    check (err == 0, "Failed to write columns.");
+
+    snprintf (path, sizeof (path), "%s.meta", prefix);
+    meta = fopen (path, "w");
+    check (meta != NULL, "Failed to open %s.", path);
+    fprintf (meta, "width: %i\nheight: %i\nplayers: ", replay->width, replay->height);
+    for (i = 0; i < replay->num; i++) {
+        fprintf (meta, "%s%s", i ? ", " : "", replay->names [i]);
+    }
+    fprintf (meta, "\nrows: %" PRIu64 "\ncolumns:", ex->rows);
+    for (i = 0; i < EXPORT_NUM_COLUMNS; i++) {
+        if (i == EXPORT_PLAYER && !(replay->fields & SAVE_TYPE)) continue;
+        if (i == EXPORT_ENERGY && !(replay->fields & SAVE_ENERGY)) continue;
+        if (i == EXPORT_MEMORY && !(replay->fields & SAVE_MEMORY)) continue;
+        fprintf (meta, " %s/u%i", column_names [i], 8 * column_sizes [i]);
+    }
+    fputc ('\n', meta);
+    err = ferror (meta) | fclose (meta);
+    check (err == 0, "Failed to write %s.", path);
+
+    return 0;
+
+error:
+    return 1;
+}
+
+/* Parses "first:last", "first:", ":last" or just "turn" */
+static int
+export_parse_turns (Export *ex, const char *arg)
+{
+    char *end;
+    const char *colon = strchr (arg, ':');
+
+    if (!colon) {
+        ex->first = ex->last = strtoul (arg, &end, 10);
+        return *end != '\0';
+    }
+    if (colon != arg) {
+        ex->first = strtoul (arg, &end, 10);
+        if (end != colon) return 1;
+    }
+    if (colon [1] != '\0') {
+        ex->last = strtoul (colon + 1, &end, 10);
+        if (*end != '\0') return 1;
+    }
+    return 0;
+}
+
+int
+main (int argc, char **argv)
+{
+    int opt, err, x0, y0, x1, y1;
+    unsigned int n;
+    const char *prefix = NULL;
+    Replay *replay = NULL;
+    ReplayFrame *frame = NULL;
+    Export ex = {
+        .format = EXPORT_NDJSON,
+        .last   = (unsigned int) -1,
+        .width  = -1,
+        .height = -1,
+        .out    = stdout
+    };
+
+    while ((opt = getopt (argc, argv, "o:t:r:e")) != -1) {
+        switch (opt) {
+            case 'o':
+                if (strcmp (optarg, "ndjson") == 0)       ex.format = EXPORT_NDJSON;
+                else if (strcmp (optarg, "csv") == 0)     ex.format = EXPORT_CSV;
+                else if (strcmp (optarg, "columns") == 0) ex.format = EXPORT_COLUMNS;
+                else {
+                    usage ();
+                    return 1;
+                }
+                break;
+            case 't':
+                if (export_parse_turns (&ex, optarg) != 0) {
+                    usage ();
+                    return 1;
+                }
+                break;
+            case 'r':
+                if (sscanf (optarg, "%i,%i,%i,%i", &ex.x, &ex.y, &ex.width, &ex.height) != 4) {
+                    usage ();
+                    return 1;
+                }
+                break;
+            case 'e':
+                ex.drop_empty = 1;
+                break;
+            default:
+                usage ();
+                return 1;
+        }
+    }
+    argc -= optind - 1;
+    argv += optind - 1;
+
+    if (argc < 2 || argc > 3 || (ex.format == EXPORT_COLUMNS && argc != 3)) {
+        usage ();
+        return 1;
+    }
+
+    replay = Replay_open (argv [1]);
+    check (replay != NULL, "Failed to open replay %s.", argv [1]);
+    frame = ReplayFrame_create (replay);
+    check (frame != NULL, "Failed to create frame.");
+
+    // clip the region to the field
+    if (ex.width < 0)  ex.width  = replay->width;
+    if (ex.height < 0) ex.height = replay->height;
+    x0 = ex.x < 0 ? 0 : ex.x;
+    y0 = ex.y < 0 ? 0 : ex.y;
+    x1 = ex.x + ex.width > replay->width ? replay->width : ex.x + ex.width;
+    y1 = ex.y + ex.height > replay->height ? replay->height : ex.y + ex.height;
+    ex.x = x0;
+    ex.y = y0;
+    ex.width  = x1 > x0 ? x1 - x0 : 0;
+    ex.height = y1 > y0 ? y1 - y0 : 0;
+
+    if (ex.last >= replay->frames) ex.last = replay->frames - 1;
+
+    if (ex.format == EXPORT_COLUMNS) {
+        prefix = argv [2];
+        err = export_columns_open (&ex, replay, prefix);
+        check (err == 0, "Failed to open columns.");
+    } else if (argc == 3 && strcmp (argv [2], "-") != 0) {
+        ex.out = fopen (argv [2], "w");
+        check (ex.out != NULL, "Failed to open %s.", argv [2]);
+    }
+
+    if (ex.format == EXPORT_CSV) export_csv_header (&ex, replay);
+
+    // frames are read in order, so only every keyframe interval'th one is
+    // decoded from scratch and memory stays at one frame
+    for (n = ex.first; replay->frames > 0 && n <= ex.last; n++) {
+        err = Replay_frame (frame, n);
+        check (err == 0, "Failed to read frame %u.", n);
+
+        switch (ex.format) {
+            case EXPORT_NDJSON:
+                export_ndjson (&ex, frame, n);
+                break;
+            case EXPORT_CSV:
+                export_csv (&ex, frame, n);
+                break;
+            case EXPORT_COLUMNS:
+                export_columns (&ex, frame, n);
+                break;
+        }
+    }
+
+    if (ex.format == EXPORT_COLUMNS) {
+        err = export_columns_close (&ex, replay, prefix);
+        check (err == 0, "Failed to finish columns.");
+    } else {
+        err = ferror (ex.out) | (ex.out != stdout ? fclose (ex.out) : fflush (ex.out));
+        ex.out = stdout;
+        check (err == 0, "Failed to write output.");
+    }
+
+    ReplayFrame_destroy (frame);
+    Replay_close (replay);
+    return 0;
+
+error:
+    for (n = 0; n < EXPORT_NUM_COLUMNS; n++) {
+        if (ex.columns [n]) fclose (ex.columns [n]);
+    }
+    if (ex.out && ex.out != stdout) fclose (ex.out);
+    ReplayFrame_destroy (frame);
+    Replay_close (replay);
+    return 1;
+}
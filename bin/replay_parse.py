@@ -4,6 +4,17 @@ import struct
 import json
 import sys
 
+try:
+    import cellhack_replay
+except ImportError:
+    cellhack_replay = None
+
+# see lib/cellhack/save.h for the layout of both versions
+MAGIC = b"CHREPLAY"
+FOOTER_MAGIC = b"CHRI"
+TYPE, ENERGY, MEMORY = 1, 2, 4
+KEYFRAME, DELTA = 0, 1
+
 def parse_meta (buf):
     # last char is a newline, we don't want that
     txt = bytes(itertools.takewhile(lambda c: c != 0,
@@ -15,28 +26,128 @@ def parse_meta (buf):
     return meta_data
 
 cell_struct = struct.Struct("=BBQ")
-def parse_cell (buf, players):
-    raw = buf.read (cell_struct.size)
-    if len(raw) < cell_struct.size: raise EOFError
+def parse_cell (raw, players):
     player_id, energy, memory = cell_struct.unpack (raw)
     return {"player": players [player_id],
             "energy": energy,
             "memory": memory}
 
 def parse_frames (buf, width, height, players):
+    size = cell_struct.size * width * height
+    while 1:
+        raw = buf.read (size)
+        if len (raw) < size: return
+
+        frame = []
+        for y in range (height):
+            frame.append ([])
+            for x in range (width):
+                off = cell_struct.size * (x + y * width)
+                frame [-1].append (parse_cell (raw [off:off + cell_struct.size],
+                                               players))
+
+        yield frame
+
+def get_varint (raw, pos):
+    v = shift = 0
     while 1:
+        b = raw [pos]
+        pos += 1
+        v |= (b & 0x7f) << shift
+        shift += 7
+        if not b & 0x80: return v, pos
+
+def unpack (raw):
+    out = bytearray ()
+    pos = 0
+    while pos < len (raw):
+        n, pos = get_varint (raw, pos)
+        out += raw [pos:pos + n]
+        pos += n
+        m, pos = get_varint (raw, pos)
+        if m:
+            out += raw [pos:pos + 1] * m
+            pos += 1
+    return bytes (out)
+
+def parse_frames_v2 (buf, width, height, players, fields, frames):
+    cells = width * height
+    types = bytearray (cells)
+    energies = bytearray (cells)
+    memories = [0] * cells
+
+    for _ in range (frames):
+        kind, raw_size, packed_size = struct.unpack ("<BII", buf.read (9))
+        raw = unpack (buf.read (packed_size))
+
+        if kind == KEYFRAME:
+            pos = 0
+            if fields & TYPE:
+                types [:] = raw [pos:pos + cells]
+                pos += cells
+            if fields & ENERGY:
+                energies [:] = raw [pos:pos + cells]
+                pos += cells
+            if fields & MEMORY:
+                planes = [raw [pos + b * cells:pos + (b + 1) * cells] for b in range (8)]
+                memories = [sum (planes [b][i] << (8 * b) for b in range (8))
+                            for i in range (cells)]
+        else:
+            count, pos = get_varint (raw, 0)
+            idx = -1
+            for _ in range (count):
+                gap, pos = get_varint (raw, pos)
+                idx += gap
+                if fields & TYPE:
+                    types [idx] = raw [pos]
+                    pos += 1
+                if fields & ENERGY:
+                    energies [idx] = raw [pos]
+                    pos += 1
+                if fields & MEMORY:
+                    memories [idx], pos = get_varint (raw, pos)
+
         frame = []
-        for _ in range (height):
+        for y in range (height):
             frame.append ([])
-            for _ in range (width):
-                try:
-                    frame [-1].append (parse_cell (buf, players))
-                except EOFError:
-                    raise StopIteration
+            for x in range (width):
+                idx = x + y * width
+                cell = {}
+                if fields & TYPE:   cell ["player"] = players [types [idx]]
+                if fields & ENERGY: cell ["energy"] = energies [idx]
+                if fields & MEMORY: cell ["memory"] = memories [idx]
+                frame [-1].append (cell)
 
         yield frame
 
+def parse_frames_lib (path, players):
+    with cellhack_replay.Replay (path) as replay:
+        width, fields = replay.width, replay.fields
+        for types, energies, memories in replay:
+            frame = []
+            for y in range (replay.height):
+                frame.append ([])
+                for x in range (width):
+                    idx = x + y * width
+                    cell = {}
+                    if fields & TYPE:   cell ["player"] = players [types [idx]]
+                    if fields & ENERGY: cell ["energy"] = energies [idx]
+                    if fields & MEMORY: cell ["memory"] = memories [idx]
+                    frame [-1].append (cell)
+            yield frame
+
 def parse (buf):
+    version = 1
+    if buf.peek (len (MAGIC)) [:len (MAGIC)] == MAGIC:
+        (_, version, header_size, width, height, num, fields, keyframes,
+            meta_size) = struct.unpack ("<8s8I", buf.read (40))
+        buf.seek (-16, 2)
+        index, frames, magic = struct.unpack ("<QI4s", buf.read (16))
+        if magic != FOOTER_MAGIC:
+            print ("replay file is not finished, bailing.")
+            sys.exit (1)
+        buf.seek (40)
+
     meta_data = parse_meta (buf)
 
     try:
@@ -48,7 +159,15 @@ def parse (buf):
         print ("replay file lacks some meta data, bailing.")
         sys.exit (1)
 
-    frames = list(parse_frames(buf, width, height, players))
+    # decoding in C is a lot faster, if the library was built
+    if cellhack_replay and cellhack_replay.available ():
+        frames = list (parse_frames_lib (buf.name, players))
+    elif version == 1:
+        frames = list (parse_frames (buf, width, height, players))
+    else:
+        buf.seek (header_size)
+        frames = list (parse_frames_v2 (buf, width, height, players, fields,
+                                        frames))
     return {"meta": meta_data, "frames": frames}
 
 if __name__ == "__main__":
@@ -58,4 +177,3 @@ if __name__ == "__main__":
         else:
             with open (sys.argv [2], "w") as ofile:
                 json.dump (parse (ifile), ofile)
-
@@ -0,0 +1,413 @@
+// Copyright 2015 Marvin Poul
+// Licensed under the Do What The Fuck You Want To License, Version 2
+// See LICENSE for details or http://www.wtfpl.net/txt/copying
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "dbg.h"
+#include "cellhack/palette.h"
+#include "cellhack/pool.h"
+#include "cellhack/replay.h"
+
+#define usage() fprintf (stderr, "USAGE: replay_render [-o ppm|png|raw] [-j threads] [-t first:last] [-s stride] [-d cells_per_pixel] [-z pixels_per_cell] replay_file output")
+
+#define RENDER_PPM 0
+#define RENDER_PNG 1
+#define RENDER_RAW 2
+
+// frames every executor renders per run when writing a raw stream, which
+// has to wait for all of them before writing them out in order
+#define RENDER_BATCH 4
+
+// largest payload of a stored deflate block
+#define RENDER_BLOCK 65535
+
+typedef struct {
+    const Replay *replay;
+    // one per executor, so that every one decodes forward from its last frame
+    ReplayFrame **frames;
+    int workers;
+    Palette *palette;
+    int format;
+    // frames first, first + stride, … up to last inclusive are rendered
+    unsigned int first;
+    unsigned int last;
+    unsigned int stride;
+    // every pixel averages down x down cells, every cell covers zoom x zoom
+    // pixels, only one of them is above 1
+    int down;
+    int zoom;
+    // size of the images
+    int width;
+    int height;
+    // output prefix of the images or the raw stream
+    const char *output;
+    FILE *out;
+    // position of the first frame of the current run among the rendered
+    // ones and a buffer per frame of the run
+    unsigned int base;
+    uint8_t **images;
+    // set if any frame failed
+    int failed;
+} Render;
+
+static uint32_t crc_table [256];
+
+static void
+crc_init (void)
+{
+    uint32_t c;
+    int n, k;
+
+    for (n = 0; n < 256; n++) {
+        for (c = n, k = 0; k < 8; k++) {
+            c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+        }
+        crc_table [n] = c;
+    }
+}
+
+/* Continues the CRC-32 crc (start with 0) over size bytes of buf */
+static uint32_t
+crc_update (uint32_t crc, const uint8_t *buf, size_t size)
+{
+    crc = ~crc;
+    for (; size > 0; size--, buf++) {
+        crc = crc_table [(crc ^ *buf) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static inline uint8_t *
+put_u32be (uint8_t *dst, uint32_t v)
+{
+    dst [0] = v >> 24;
+    dst [1] = v >> 16;
+    dst [2] = v >> 8;
+    dst [3] = v;
+    return dst + 4;
+}
+
+/* Writes size bytes of buf to out and adds them to the CRC of the current
+ * chunk */
+static void
+png_put (FILE *out, uint32_t *crc, const uint8_t *buf, size_t size)
+{
+    fwrite (buf, 1, size, out);
+    *crc = crc_update (*crc, buf, size);
+}
+
+/* Writes a whole chunk of size bytes of data */
+static void
+png_chunk (FILE *out, const char *type, const uint8_t *data, uint32_t size)
+{
+    uint8_t len [4], crc_buf [4];
+    uint32_t crc = 0;
+
+    put_u32be (len, size);
+    fwrite (len, 1, 4, out);
+    png_put (out, &crc, (const uint8_t *) type, 4);
+    png_put (out, &crc, data, size);
+    put_u32be (crc_buf, crc);
+    fwrite (crc_buf, 1, 4, out);
+}
+
+/* Writes image as 8 bit RGB PNG, its pixels go to stored (uncompressed)
+ * deflate blocks, which keeps this free of any library */
+static void
+render_png (Render *r, FILE *out, const uint8_t *image)
+{
+    static const uint8_t signature [8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    // 8 bit RGB, no interlacing
+    uint8_t ihdr [13] = {0, 0, 0, 0, 0, 0, 0, 0, 8, 2, 0, 0, 0}, buf [5];
+    size_t row = 3 * (size_t) r->width, raw = (row + 1) * r->height;
+    size_t done, size, left, part, k, i;
+    uint32_t crc = 0, a = 1, b = 0, blocks = (raw + RENDER_BLOCK - 1) / RENDER_BLOCK;
+    // every row starts with its filter, 0 for none
+    uint8_t filter = 0;
+    const uint8_t *src;
+    int y;
+
+    fwrite (signature, 1, 8, out);
+    put_u32be (put_u32be (ihdr, r->width), r->height);
+    png_chunk (out, "IHDR", ihdr, 13);
+
+    put_u32be (buf, 2 + raw + 5 * blocks + 4);
+    fwrite (buf, 1, 4, out);
+    png_put (out, &crc, (const uint8_t *) "IDAT", 4);
+    // zlib header: deflate with a 32k window, no dictionary, fastest
+    png_put (out, &crc, (const uint8_t *) "\x78\x01", 2);
+
+    // the rows and their filter bytes, cut into blocks; y is the row and k
+    // the position within it of the next byte, row + 1 for the filter byte
+    for (done = 0, y = 0, k = row; done < raw; done += size) {
+        size = raw - done < RENDER_BLOCK ? raw - done : RENDER_BLOCK;
+        buf [0] = done + size == raw;
+        buf [1] = size;
+        buf [2] = size >> 8;
+        buf [3] = ~size;
+        buf [4] = ~size >> 8;
+        png_put (out, &crc, buf, 5);
+
+        for (left = size; left > 0; left -= part) {
+            if (k == row) {
+                png_put (out, &crc, &filter, 1);
+                b = (b + a) % 65521;
+                k = 0;
+                part = 1;
+                continue;
+            }
+            part = row - k < left ? row - k : left;
+            src = image + y * row + k;
+            png_put (out, &crc, src, part);
+            for (i = 0; i < part; i++) {
+                a = (a + src [i]) % 65521;
+                b = (b + a) % 65521;
+            }
+            k += part;
+            if (k == row) y++;
+        }
+    }
+
+    put_u32be (buf, b << 16 | a);
+    png_put (out, &crc, buf, 4);
+    put_u32be (buf, crc);
+    fwrite (buf, 1, 4, out);
+
+    png_chunk (out, "IEND", NULL, 0);
+}
+
+/* Draws the frame held by frame into image */
+static void
+render_draw (Render *r, const ReplayFrame *frame, uint8_t *image)
+{
+    int width = r->replay->width, height = r->replay->height;
+    int x, y, cx, cy, i, j, count, c;
+    unsigned int sum [3];
+    unsigned int idx;
+    uint8_t rgb [3], *dst;
+
+    for (y = 0; y < r->height; y++) {
+        for (x = 0; x < r->width; x++) {
+            dst = image + 3 * ((size_t) y * r->width + x);
+            if (r->zoom > 1) {
+                idx = x / r->zoom + (y / r->zoom) * width;
+                Palette_shade (r->palette, ReplayFrame_type (frame, idx),
+                               ReplayFrame_energy (frame, idx), dst);
+                continue;
+            }
+
+            // average the colours of all cells the pixel covers
+            sum [0] = sum [1] = sum [2] = count = 0;
+            for (j = 0, cy = y * r->down; j < r->down && cy < height; j++, cy++) {
+                for (i = 0, cx = x * r->down; i < r->down && cx < width; i++, cx++) {
+                    idx = cx + cy * width;
+                    Palette_shade (r->palette, ReplayFrame_type (frame, idx),
+                                   ReplayFrame_energy (frame, idx), rgb);
+                    for (c = 0; c < 3; c++) sum [c] += rgb [c];
+                    count++;
+                }
+            }
+            for (c = 0; c < 3; c++) dst [c] = (sum [c] + count / 2) / count;
+        }
+    }
+}
+
+/* Writes image as file of frame n
+ * returns 0 on success, 1 on error */
+static int
+render_write (Render *r, unsigned int n, const uint8_t *image)
+{
+    char path [strlen (r->output) + 16];
+    FILE *out = NULL;
+    int err;
+
+    snprintf (path, sizeof (path), "%s%06u.%s", r->output, n,
+              r->format == RENDER_PNG ? "png" : "ppm");
+    out = fopen (path, "w");
+    check (out != NULL, "Failed to open %s.", path);
+
+    if (r->format == RENDER_PNG) {
+        render_png (r, out, image);
+    } else {
+        fprintf (out, "P6\n%i %i\n255\n", r->width, r->height);
+        fwrite (image, 3, (size_t) r->width * r->height, out);
+    }
+
+    err = ferror (out) | fclose (out);
+    check (err == 0, "Failed to write %s.", path);
+    return 0;
+
+error:
+    return 1;
+}
+
+/* Renders the chunk-th frame of the current run */
+static void
+render_frame (void *arg, unsigned int chunk, int worker)
+{
+    Render *r = arg;
+    unsigned int n = r->first + (r->base + chunk) * r->stride;
+    // image files are written right away, so one buffer per executor is
+    // enough for them
+    uint8_t *image = r->images [r->format == RENDER_RAW ? chunk : (unsigned int) worker];
+    int err;
+
+    err = Replay_frame (r->frames [worker], n);
+    check (err == 0, "Failed to read frame %u.", n);
+    render_draw (r, r->frames [worker], image);
+
+    if (r->format != RENDER_RAW) {
+        err = render_write (r, n, image);
+        check (err == 0, "Failed to write frame %u.", n);
+    }
+    return;
+
+error:
+    __atomic_store_n (&r->failed, 1, __ATOMIC_RELAXED);
+}
+
+int
+main (int argc, char **argv)
+{
+    int opt, err, i, threads = sysconf (_SC_NPROCESSORS_ONLN);
+    unsigned int count, run, k, images = 0;
+    size_t image_size;
+    ExecutorPool *pool = NULL;
+    Replay *replay = NULL;
+    Render r = {
+        .format = RENDER_PPM,
+        .last   = -1,
+        .stride = 1,
+        .down   = 1,
+        .zoom   = 1
+    };
+
+    while ((opt = getopt (argc, argv, "o:j:t:s:d:z:")) != -1) {
+        switch (opt) {
+            case 'o':
+                if (strcmp (optarg, "ppm") == 0)      r.format = RENDER_PPM;
+                else if (strcmp (optarg, "png") == 0) r.format = RENDER_PNG;
+                else if (strcmp (optarg, "raw") == 0) r.format = RENDER_RAW;
+                else {
+                    usage ();
+                    return 1;
+                }
+                break;
+            case 'j':
+                threads = atoi (optarg);
+                break;
+            case 't':
+                if (sscanf (optarg, "%u:%u", &r.first, &r.last) != 2) {
+                    usage ();
+                    return 1;
+                }
+                break;
+            case 's':
+                r.stride = atoi (optarg);
+                break;
+            case 'd':
+                r.down = atoi (optarg);
+                break;
+            case 'z':
+                r.zoom = atoi (optarg);
+                break;
+            default:
+                usage ();
+                return 1;
+        }
+    }
+    if (argc - optind != 2 || r.stride < 1 || r.down < 1 || r.zoom < 1
+        || (r.down > 1 && r.zoom > 1)) {
+        usage ();
+        return 1;
+    }
+    if (threads < 1) threads = 1;
+    r.output = argv [optind + 1];
+    crc_init ();
+
+    replay = Replay_open (argv [optind]);
+    check (replay != NULL, "Failed to open replay.");
+    r.replay = replay;
+    if (r.last >= Replay_frames (replay)) r.last = Replay_frames (replay) - 1;
+    check (Replay_frames (replay) > 0 && r.first <= r.last, "No frames to render.");
+    count = (r.last - r.first) / r.stride + 1;
+
+    r.width  = (Replay_width (replay) + r.down - 1) / r.down * r.zoom;
+    r.height = (Replay_height (replay) + r.down - 1) / r.down * r.zoom;
+    image_size = 3 * (size_t) r.width * r.height;
+
+    r.palette = Palette_create (replay->num);
+    check (r.palette != NULL, "Failed to create palette.");
+
+    pool = ExecutorPool_create (threads, 0);
+    check (pool != NULL, "Failed to create executor pool.");
+    r.workers = pool->size;
+    r.frames = calloc (r.workers, sizeof (ReplayFrame *));
+    check (r.frames != NULL, "Failed to alloc frames.");
+    for (i = 0; i < r.workers; i++) {
+        r.frames [i] = ReplayFrame_create (replay);
+        check (r.frames [i] != NULL, "Failed to create frame.");
+    }
+
+    images = r.format == RENDER_RAW ? RENDER_BATCH * (unsigned int) r.workers
+                                    : (unsigned int) r.workers;
+    r.images = calloc (images, sizeof (uint8_t *));
+    check (r.images != NULL, "Failed to alloc images.");
+    for (k = 0; k < images; k++) {
+        r.images [k] = malloc (image_size);
+        check (r.images [k] != NULL, "Failed to alloc image.");
+    }
+
+    if (r.format == RENDER_RAW) {
+        r.out = strcmp (r.output, "-") == 0 ? stdout : fopen (r.output, "w");
+        check (r.out != NULL, "Failed to open %s.", r.output);
+        log_info ("Writing %u frames of %ix%i rgb24.", count, r.width, r.height);
+    }
+
+    // image files come out of one run, in which every executor starts on a
+    // stretch of consecutive frames; raw frames are rendered in runs of a few
+    // per executor and written out in order after each of them
+    for (r.base = 0; r.base < count; r.base += run) {
+        run = r.format == RENDER_RAW ? images : count;
+        if (run > count - r.base) run = count - r.base;
+
+        err = ExecutorPool_run (pool, run, render_frame, &r, NULL);
+        check (err == 0 && !r.failed, "Failed to render frames.");
+
+        for (k = 0; k < run && r.format == RENDER_RAW; k++) {
+            check (fwrite (r.images [k], 1, image_size, r.out) == image_size,
+                   "Failed to write frame.");
+        }
+    }
+
+    if (r.out) {
+        err = fflush (r.out);
+        if (r.out != stdout) err |= fclose (r.out);
+        r.out = NULL;
+        check (err == 0, "Failed to write %s.", r.output);
+    }
+
+    for (k = 0; k < images; k++) free (r.images [k]);
+    free (r.images);
+    for (i = 0; i < r.workers; i++) ReplayFrame_destroy (r.frames [i]);
+    free (r.frames);
+    ExecutorPool_destroy (pool);
+    Palette_destroy (r.palette);
+    Replay_close (replay);
+    return 0;
+
+error:
+    if (r.out && r.out != stdout) fclose (r.out);
+    for (k = 0; r.images && k < images; k++) {
+        if (r.images [k]) free (r.images [k]);
+    }
+    if (r.images) free (r.images);
+    for (i = 0; r.frames && i < r.workers; i++) ReplayFrame_destroy (r.frames [i]);
+    if (r.frames) free (r.frames);
+    if (pool) ExecutorPool_destroy (pool);
+    if (r.palette) Palette_destroy (r.palette);
+    if (replay) Replay_close (replay);
+    return 1;
+}
@@ -0,0 +1,617 @@
+// Copyright 2015 Marvin Poul
+// Licensed under the Do What The Fuck You Want To License, Version 2
+// See LICENSE for details or http://www.wtfpl.net/txt/copying
+
+#include <dlfcn.h>
+#include <unistd.h>
+
+#include "cellhack/cellhack.h"
+#include "cellhack/save.h"
+
+#define usage() fprintf (stderr, "USAGE: tournament [-m knockout|roundrobin|swiss] [-j games] [-g group_size] [-n rounds] [-t turns] [-W width] [-h height] [-b budget_us] [-e stop_conditions] [-s] [-r seed] [-R replay_dir] [players_file]")
+
+#define TOURNAMENT_KNOCKOUT   0
+#define TOURNAMENT_ROUNDROBIN 1
+#define TOURNAMENT_SWISS      2
+
+// most players in one match
+#define TOURNAMENT_MAX_GROUP 16
+
+// points for a won, drawn and lost match in round robin and swiss play
+#define TOURNAMENT_WIN  2
+#define TOURNAMENT_DRAW 1
+
+typedef struct {
+    char *name;
+    void *dll;
+    CellHack_decide_action ai;
+    // NULL if the player has none
+    CellHack_decide_actions_batch batch_ai;
+    int pure;
+    unsigned int played;
+    unsigned int wins;
+    unsigned int draws;
+    unsigned int losses;
+    unsigned int points;
+    // cells left at the end of all matches played
+    unsigned long cells;
+    // set once out of a knockout tournament
+    int out;
+    // swiss only, set if the player had a round off since the last time
+    // everybody had one
+    int bye;
+} Player;
+
+typedef struct {
+    unsigned int round;
+    unsigned int number;
+    int num;
+    // indices into Tournament.players, in starting order
+    int players [TOURNAMENT_MAX_GROUP];
+    // cells of every player left after the last turn
+    int cells [TOURNAMENT_MAX_GROUP];
+    // most cells any player has left
+    int best;
+    // position in players of the sole player with best cells, -1 on a draw
+    int winner;
+    // set if the match could not be played
+    int failed;
+    uint64_t seed;
+} Match;
+
+typedef struct {
+    int mode;
+    Player *players;
+    int num;
+    // matches of the current round, played in parallel
+    Match *matches;
+    unsigned int matches_num;
+    unsigned int matches_size;
+    unsigned int round;
+    // matches played in all rounds so far, seeds every match
+    unsigned int played;
+    // num * num, set where two players met already
+    uint8_t *met;
+    int turns;
+    int width;
+    int height;
+    // settings of every game
+    CellHackConfig config;
+    uint64_t seed;
+    const char *replay_dir;
+} Tournament;
+
+/* Reads "name path_to_ai_so" lines from file and loads every player once
+ * returns 0 on success, 1 on error */
+static int
+tournament_load (Tournament *t, FILE *file)
+{
+    char *line = NULL, *name, *path;
+    const int *flag;
+    size_t size = 0;
+    Player *players;
+    int size_players = 0;
+
+    while (getline (&line, &size, file) != -1) {
+        name = strtok (line, " \t\n");
+        path = strtok (NULL, " \t\n");
+        if (!name) continue;
+        check (path != NULL, "Player '%s' lacks the path to its ai.", name);
+
+        if (t->num == size_players) {
+            size_players = size_players ? 2 * size_players : 16;
+            players = realloc (t->players, size_players * sizeof (Player));
+            check (players != NULL, "Failed to grow player list.");
+            t->players = players;
+        }
+
+        Player *p = t->players + t->num;
+        memset (p, 0, sizeof (Player));
+        p->dll = dlopen (path, RTLD_LAZY);
+        check (p->dll != NULL, "Failed to load dll for player '%s': %s", name, dlerror ());
+        t->num++;
+        p->ai = dlsym (p->dll, "cell_decide_action");
+        check (p->ai != NULL, "Failed to load ai function for player '%s': %s",
+               name, dlerror ());
+        p->batch_ai = dlsym (p->dll, "cell_decide_actions_batch");
+        flag = dlsym (p->dll, "cell_pure");
+        p->pure = flag && *flag;
+        p->name = strdup (name);
+        check (p->name != NULL, "Failed to copy player name.");
+    }
+    free (line);
+    line = NULL;
+
+    check (t->num >= 2, "A tournament needs at least two players.");
+
+    t->met = calloc (t->num * t->num, sizeof (uint8_t));
+    check (t->met != NULL, "Failed to alloc pairing table.");
+
+    return 0;
+
+error:
+    if (line) free (line);
+    return 1;
+}
+
+/* Appends a match of players to the current round
+ * returns 0 on success, 1 on error */
+static int
+tournament_add_match (Tournament *t, const int *players, int num)
+{
+    Match *matches;
+    unsigned int size;
+
+    if (t->matches_num == t->matches_size) {
+        size = t->matches_size ? 2 * t->matches_size : 64;
+        matches = realloc (t->matches, size * sizeof (Match));
+        check (matches != NULL, "Failed to grow match list.");
+        t->matches = matches;
+        t->matches_size = size;
+    }
+
+    Match *m = t->matches + t->matches_num;
+    memset (m, 0, sizeof (Match));
+    m->round  = t->round;
+    m->number = t->matches_num + 1;
+    m->num    = num;
+    memcpy (m->players, players, num * sizeof (int));
+    // by position in the whole tournament, so that results do not depend on
+    // which game finishes first
+    m->seed   = t->seed + t->played + t->matches_num;
+    t->matches_num++;
+
+    return 0;
+
+error:
+    return 1;
+}
+
+/* Plays match number chunk of the current round, run by the executor pool */
+static void
+tournament_play (void *arg, unsigned int chunk, int worker)
+{
+    (void) worker;
+    Tournament *t = arg;
+    Match *m = t->matches + chunk;
+    CellHack_decide_action ais [TOURNAMENT_MAX_GROUP];
+    CellHack_decide_actions_batch batch_ais [TOURNAMENT_MAX_GROUP];
+    int pure [TOURNAMENT_MAX_GROUP];
+    char *names [TOURNAMENT_MAX_GROUP];
+    unsigned int cells [TOURNAMENT_MAX_GROUP];
+    char path [4096];
+    CellHackConfig config = t->config;
+    GameState *gs = NULL;
+    Save *save = NULL;
+    FILE *file = NULL;
+    int i, err, all_pure = 1;
+
+    for (i = 0; i < m->num; i++) {
+        ais [i]   = t->players [m->players [i]].ai;
+        batch_ais [i] = t->players [m->players [i]].batch_ai;
+        pure [i]      = t->players [m->players [i]].pure;
+        names [i] = t->players [m->players [i]].name;
+        all_pure &= pure [i];
+    }
+    // the engine would only complain about looking for cycles in vain
+    if (!all_pure) config.stop &= ~CELLHACK_STOP_CYCLE;
+    config.seed = m->seed;
+    config.batch_ai = batch_ais;
+    config.pure = pure;
+
+    gs = CellHack_init_config (t->width, t->height, m->num, ais, names, &config);
+    check (gs != NULL, "Failed to init match %u of round %u.", m->number, m->round);
+
+    if (t->replay_dir) {
+        snprintf (path, sizeof (path), "%s/round-%u-match-%u", t->replay_dir,
+                  m->round, m->number);
+        file = fopen (path, "w");
+        check (file != NULL, "Failed to open replay file %s.", path);
+        save = Save_create (file, t->width, t->height, m->num, names, NULL);
+        check (save != NULL, "Failed to start replay %s.", path);
+        err = Save_frame (save, Cellhack_types (gs), Cellhack_energies (gs),
+                          Cellhack_memories (gs));
+        check (err == 0, "Failed to save turn %i.", Cellhack_turns (gs));
+    }
+
+    while (Cellhack_turns (gs) < t->turns && !CellHack_stopped (gs)) {
+        CellHack_tick (gs);
+        if (save) {
+            err = Save_frame (save, Cellhack_types (gs), Cellhack_energies (gs),
+                              Cellhack_memories (gs));
+            check (err == 0, "Failed to save turn %i.", Cellhack_turns (gs));
+        }
+    }
+
+    // survivor stops are refused, so the rest of the match is known
+    err = CellHack_standings (gs, t->turns, cells);
+    check (err == 0, "Cells of match %u of round %u are unknown.", m->number, m->round);
+    for (i = 0; i < m->num; i++) {
+        m->cells [i] = cells [i];
+    }
+    for (i = 0, m->best = -1, m->winner = -1; i < m->num; i++) {
+        if (m->best < m->cells [i]) {
+            m->best = m->cells [i];
+            m->winner = i;
+        } else if (m->best == m->cells [i]) {
+            m->winner = -1;
+        }
+    }
+
+    if (save) {
+        err = Save_destroy (save);
+        save = NULL;
+        check (err == 0, "Failed to finish replay %s.", path);
+    }
+    CellHack_destroy (gs);
+    return;
+
+error:
+    m->failed = 1;
+    if (save) Save_destroy (save);
+    if (gs) CellHack_destroy (gs);
+}
+
+/* Adds the results of the current round to the standings and prints them */
+static void
+tournament_score (Tournament *t)
+{
+    unsigned int k;
+    int i, j;
+    Match *m;
+    Player *p;
+
+    for (k = 0; k < t->matches_num; k++) {
+        m = t->matches + k;
+        printf ("round %u match %u:", m->round, m->number);
+        if (m->failed) {
+            printf (" failed\n");
+            continue;
+        }
+
+        for (i = 0; i < m->num; i++) {
+            p = t->players + m->players [i];
+            p->played++;
+            p->cells += m->cells [i];
+            if (m->winner == i) {
+                p->wins++;
+                p->points += TOURNAMENT_WIN;
+            } else if (m->winner == -1) {
+                p->draws++;
+                p->points += TOURNAMENT_DRAW;
+            } else {
+                p->losses++;
+            }
+            for (j = 0; j < m->num; j++) {
+                t->met [m->players [i] * t->num + m->players [j]] = 1;
+            }
+            printf ("%s %s %i", i ? "," : "", p->name, m->cells [i]);
+        }
+        printf (" -> %s\n", m->winner == -1 ? "draw"
+                            : t->players [m->players [m->winner]].name);
+    }
+    t->played += t->matches_num;
+}
+
+/* Plays all matches of the current round in parallel
+ * returns 0 on success, 1 on error */
+static int
+tournament_round (Tournament *t, ExecutorPool *pool)
+{
+    int err = 0;
+
+    if (t->matches_num > 0) {
+        err = ExecutorPool_run (pool, t->matches_num, tournament_play, t, NULL);
+        check (err == 0, "Failed to play round %u.", t->round);
+    }
+    tournament_score (t);
+
+    return 0;
+
+error:
+    return 1;
+}
+
+/* Pits the players still in the tournament against each other in groups of
+ * group, the winner of every group goes on; players left without a group and
+ * the first of the players tied for most cells in a drawn group go on as well
+ * returns 0 on success, 1 on error */
+static int
+tournament_knockout (Tournament *t, ExecutorPool *pool, int group)
+{
+    int left [t->num];
+    int i, j, n, err, next;
+    Match *m;
+
+    for (;;) {
+        for (i = 0, n = 0; i < t->num; i++) {
+            if (!t->players [i].out) left [n++] = i;
+        }
+        if (n < 2) break;
+
+        t->round++;
+        t->matches_num = 0;
+        for (i = 0; i + 1 < n; i += group) {
+            err = tournament_add_match (t, left + i, n - i < group ? n - i : group);
+            check (err == 0, "Failed to pair round %u.", t->round);
+        }
+        err = tournament_round (t, pool);
+        check (err == 0, "Failed to play round %u.", t->round);
+
+        for (i = 0; i < (int) t->matches_num; i++) {
+            m = t->matches + i;
+            // the winner is the only player with best cells if there is one
+            for (next = 0; next < m->num && m->cells [next] != m->best; next++);
+            for (j = 0; j < m->num; j++) {
+                if (m->failed || j != next) {
+                    t->players [m->players [j]].out = 1;
+                }
+            }
+        }
+    }
+
+    return 0;
+
+error:
+    return 1;
+}
+
+/* Every player meets every other player once, all in one round
+ * returns 0 on success, 1 on error */
+static int
+tournament_roundrobin (Tournament *t, ExecutorPool *pool)
+{
+    int pair [2], err;
+
+    t->round = 1;
+    for (pair [0] = 0; pair [0] < t->num; pair [0]++) {
+        for (pair [1] = pair [0] + 1; pair [1] < t->num; pair [1]++) {
+            err = tournament_add_match (t, pair, 2);
+            check (err == 0, "Failed to pair players.");
+        }
+    }
+
+    return tournament_round (t, pool);
+
+error:
+    return 1;
+}
+
+static Tournament *standings;
+
+/* Orders players by points, then by cells, then by name */
+static int
+tournament_compare (const void *a, const void *b)
+{
+    const Player *p = standings->players + *(const int *) a;
+    const Player *q = standings->players + *(const int *) b;
+
+    if (p->points != q->points) return p->points < q->points ? 1 : -1;
+    if (p->cells != q->cells) return p->cells < q->cells ? 1 : -1;
+    return strcmp (p->name, q->name);
+}
+
+/* Sorts the indices of all players into order by their standing */
+static void
+tournament_rank (Tournament *t, int *order)
+{
+    int i;
+
+    for (i = 0; i < t->num; i++) order [i] = i;
+    standings = t;
+    qsort (order, t->num, sizeof (int), tournament_compare);
+}
+
+/* Swiss pairing: every round pairs players of about the same standing that
+ * did not meet yet, the lowest ranked player without one gets a round off
+ * (and a win) if their number is odd
+ * returns 0 on success, 1 on error */
+static int
+tournament_swiss (Tournament *t, ExecutorPool *pool, int rounds)
+{
+    int order [t->num];
+    uint8_t paired [t->num];
+    int i, j, n, pair [2], err;
+
+    for (n = 1; (1 << n) < t->num; n++);
+    if (rounds <= 0) rounds = n;
+
+    while ((int) t->round < rounds) {
+        t->round++;
+        t->matches_num = 0;
+        tournament_rank (t, order);
+        memset (paired, 0, sizeof (paired));
+
+        if (t->num % 2 == 1) {
+            for (i = t->num - 1; i >= 0 && t->players [order [i]].bye; i--);
+            // everybody had one already, start over from the bottom
+            if (i < 0) {
+                for (i = 0; i < t->num; i++) t->players [i].bye = 0;
+                i = t->num - 1;
+            }
+            paired [i] = 1;
+            t->players [order [i]].bye = 1;
+            t->players [order [i]].played++;
+            t->players [order [i]].wins++;
+            t->players [order [i]].points += TOURNAMENT_WIN;
+            printf ("round %u: %s has a bye\n", t->round, t->players [order [i]].name);
+        }
+
+        for (i = 0; i < t->num; i++) {
+            if (paired [i]) continue;
+            // closest player below that was not met yet, or just the closest
+            for (j = i + 1, n = -1; j < t->num; j++) {
+                if (paired [j]) continue;
+                if (n == -1) n = j;
+                if (!t->met [order [i] * t->num + order [j]]) {
+                    n = j;
+                    break;
+                }
+            }
+            if (n == -1) break;
+
+            paired [i] = paired [n] = 1;
+            pair [0] = order [i];
+            pair [1] = order [n];
+            err = tournament_add_match (t, pair, 2);
+            check (err == 0, "Failed to pair round %u.", t->round);
+        }
+
+        err = tournament_round (t, pool);
+        check (err == 0, "Failed to play round %u.", t->round);
+    }
+
+    return 0;
+
+error:
+    return 1;
+}
+
+/* Prints the final standings */
+static void
+tournament_print (Tournament *t)
+{
+    int order [t->num];
+    int i;
+    Player *p;
+
+    if (t->mode == TOURNAMENT_KNOCKOUT) {
+        for (i = 0; i < t->num && t->players [i].out; i++);
+        if (i < t->num) printf ("Winner: %s\n", t->players [i].name);
+    }
+
+    tournament_rank (t, order);
+    printf ("Rank Player Points Won Drawn Lost Cells\n");
+    for (i = 0; i < t->num; i++) {
+        p = t->players + order [i];
+        printf ("%i %s %u %u %u %u %lu\n", i + 1, p->name, p->points, p->wins,
+                p->draws, p->losses, p->cells);
+    }
+}
+
+int
+main (int argc, char **argv)
+{
+    int opt, err, i, group = 2, rounds = 0, games = sysconf (_SC_NPROCESSORS_ONLN);
+    FILE *input = stdin;
+    ExecutorPool *pool = NULL;
+    Tournament t = {
+        .mode   = TOURNAMENT_KNOCKOUT,
+        .turns  = 100,
+        .width  = 40,
+        .height = 40,
+        .config = {
+            .threads = 1,
+            .standby = 1,
+            .budget  = 1000000,
+            .timeout = 1,
+            // both leave the cells of every player as they would be after
+            // the last turn
+            .stop    = CELLHACK_STOP_EXTINCT | CELLHACK_STOP_CYCLE
+        }
+    };
+
+    while ((opt = getopt (argc, argv, "m:j:g:n:t:W:h:b:e:sr:R:")) != -1) {
+        switch (opt) {
+            case 'm':
+                if (strcmp (optarg, "knockout") == 0)        t.mode = TOURNAMENT_KNOCKOUT;
+                else if (strcmp (optarg, "roundrobin") == 0) t.mode = TOURNAMENT_ROUNDROBIN;
+                else if (strcmp (optarg, "swiss") == 0)      t.mode = TOURNAMENT_SWISS;
+                else {
+                    usage ();
+                    return 1;
+                }
+                break;
+            case 'j':
+                games = atoi (optarg);
+                break;
+            case 'g':
+                group = atoi (optarg);
+                break;
+            case 'n':
+                rounds = atoi (optarg);
+                break;
+            case 't':
+                t.turns = atoi (optarg);
+                break;
+            case 'W':
+                t.width = atoi (optarg);
+                break;
+            case 'h':
+                t.height = atoi (optarg);
+                break;
+            case 'b':
+                t.config.budget = strtoul (optarg, NULL, 10);
+                break;
+            case 'e':
+                t.config.stop = CellHack_parse_stop (optarg);
+                // a survivor's cells decide ties, so they have to be exact
+                if (t.config.stop < 0 || (t.config.stop & CELLHACK_STOP_SURVIVOR)) {
+                    usage ();
+                    return 1;
+                }
+                break;
+            case 's':
+                t.config.sandbox = 1;
+                break;
+            case 'r':
+                t.seed = strtoull (optarg, NULL, 0);
+                break;
+            case 'R':
+                t.replay_dir = optarg;
+                break;
+            default:
+                usage ();
+                return 1;
+        }
+    }
+    if (optind + 1 < argc || group < 2 || group > TOURNAMENT_MAX_GROUP) {
+        usage ();
+        return 1;
+    }
+    if (games < 1) games = 1;
+
+    if (optind < argc) {
+        input = fopen (argv [optind], "r");
+        check (input != NULL, "Failed to open %s.", argv [optind]);
+    }
+    err = tournament_load (&t, input);
+    check (err == 0, "Failed to load players.");
+
+    // one game per executor, every game brings executors of its own for its
+    // players
+    pool = ExecutorPool_create (games, 0);
+    check (pool != NULL, "Failed to create executor pool.");
+
+    switch (t.mode) {
+        case TOURNAMENT_KNOCKOUT:
+            err = tournament_knockout (&t, pool, group);
+            break;
+        case TOURNAMENT_ROUNDROBIN:
+            err = tournament_roundrobin (&t, pool);
+            break;
+        case TOURNAMENT_SWISS:
+            err = tournament_swiss (&t, pool, rounds);
+            break;
+    }
+    check (err == 0, "Failed to play tournament.");
+
+    tournament_print (&t);
+
+    err = 0;
+    goto out;
+
+error:
+    err = 1;
+out:
+    if (pool) ExecutorPool_destroy (pool);
+    for (i = 0; i < t.num; i++) {
+        dlclose (t.players [i].dll);
+        if (t.players [i].name) free (t.players [i].name);
+    }
+    if (t.players) free (t.players);
+    if (t.matches) free (t.matches);
+    if (t.met) free (t.met);
+    if (input && input != stdin) fclose (input);
+    return err;
+}
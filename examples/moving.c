@@ -5,3 +5,14 @@ uint8_t cell_decide_action (uint8_t *env, uint8_t energy,
 {
     return MOVE_LEFT;
 }
+
+void cell_decide_actions_batch (unsigned int count, uint8_t *env,
+                                uint8_t *energy, uint64_t *memory,
+                                uint8_t *action)
+{
+    unsigned int k;
+
+    for (k = 0; k < count; k++) {
+        action [k] = MOVE_LEFT;
+    }
+}
@@ -6,6 +6,8 @@
 // 7 -> 8
 #define transDir(i) (1 << (i) / 2)
 
+const int cell_pure = 1;
+
 uint8_t cell_decide_action (uint8_t *env, uint8_t energy,
                             uint64_t *memory)
 {
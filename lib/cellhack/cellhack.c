@@ -3,62 +3,332 @@
 // See LICENSE for details or http://www.wtfpl.net/txt/copying
 
 #include "cellhack.h"
+#include "environment.h"
+#include "memo.h"
+#include "sandbox.h"
+
+/* Decides on one chunk through the player's decision cache or batch entry
+ * point, its cells are copied into contiguous arrays and the memories copied
+ * back afterwards
+ */
+static void
+decide_staged (GameState *gs, unsigned int chunk, uint8_t player, int worker)
+{
+    uint8_t env [CELLHACK_CHUNK][9], energy [CELLHACK_CHUNK], action [CELLHACK_CHUNK];
+    uint64_t memory [CELLHACK_CHUNK];
+    unsigned int k, pos, idx, first = gs->chunk_start [chunk];
+    unsigned int count = gs->chunk_start [chunk + 1] - first;
+
+    for (k = 0; k < count; k++) {
+        pos = gs->work [first + k];
+        idx = gs->live [pos];
+        memcpy (env [k], gs->env + 9 * pos, 9);
+        energy [k] = gs->energy [idx];
+        memory [k] = gs->memory [idx];
+    }
+
+    Memo_decide (gs->memo [player], gs->ai [player], gs->batch_ai [player], count,
+                 env [0], energy, memory, action,
+                 gs->profile ? gs->profile->decisions + worker * gs->num + player : NULL);
+
+    for (k = 0; k < count; k++) {
+        pos = gs->work [first + k];
+        gs->actions [pos] = action [k];
+        gs->memory [gs->live [pos]] = memory [k];
+    }
+}
 
-void *
-Executor (ExecutorArgs *args)
+/* Decides the actions of all cells in one chunk of the work list
+ */
+static void
+decide_chunk (GameState *gs, unsigned int chunk, int worker)
 {
-    Cell *cell;
-    int err = 0;
-    uint8_t result = 0;
-    check (args != NULL, "Got NULL as args.");
-    err = pthread_setcanceltype (PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
-    check (err == 0, "Failed to set cancel type to asynchronous.");
+    unsigned int k, pos, idx;
+    uint8_t player = gs->chunk_player [chunk];
+    CellHack_decide_action work = gs->ai [player];
+
+    if (gs->batch_ai [player] || gs->memo [player] || gs->profile) {
+        if (__atomic_load_n (gs->budget.exceeded + player, __ATOMIC_RELAXED)) return;
+        decide_staged (gs, chunk, player, worker);
+        return;
+    }
 
-    while (1) {
+    for (k = gs->chunk_start [chunk]; k < gs->chunk_start [chunk + 1]; k++) {
+        // player ran out of time, possibly on another executor
+        if (__atomic_load_n (gs->budget.exceeded + player, __ATOMIC_RELAXED)) return;
 
-        pthread_barrier_wait (&args->barrier);
+        pos = gs->work [k];
+        idx = gs->live [pos];
+        gs->actions [pos] = work (gs->env + 9 * pos, gs->energy [idx],
+                                  gs->memory + idx);
+    }
+}
 
-        pthread_mutex_lock (&args->lock);
+/* returns the index of the neighbour of cell idx in direction dir, the field
+ * wraps around at the edges
+ */
+static inline unsigned int
+neighbour (GameState *gs, unsigned int idx, uint8_t dir)
+{
+    int x = idx % gs->width + dir % 3 - 1;
+    int y = idx / gs->width + dir / 3 - 1;
 
-        cell = args->arg_cell;
+    if (x < 0) x += gs->width;
+    else if (x >= gs->width) x -= gs->width;
+    if (y < 0) y += gs->height;
+    else if (y >= gs->height) y -= gs->height;
 
-        pthread_mutex_unlock (&args->lock);
+    return x + y * gs->width;
+}
 
-        // mutex must be unlocked here otherwise the main thread cannot cancel
-        // if the user function unexpectedly blocks (because it cannot wake up
-        // from the condition wait).
-        result = args->work (cell->env, cell->energy, &cell->memory);
+/* Sets the type of slot idx and keeps the occupancy bitmap in sync, safe to
+ * call for different slots from several executors at once
+ */
+static inline void
+set_type (GameState *gs, unsigned int idx, uint8_t type)
+{
+    gs->type [idx] = type;
+    if (type == 0 || type == 255) {
+        __atomic_fetch_and (gs->occupied + idx / 64, ~(1ull << idx % 64),
+                            __ATOMIC_RELAXED);
+    } else {
+        __atomic_fetch_or (gs->occupied + idx / 64, 1ull << idx % 64,
+                           __ATOMIC_RELAXED);
+    }
+}
 
-        pthread_mutex_lock (&args->lock);
+/* returns the contribution of slot idx to the board hash */
+static inline uint64_t
+cell_key (GameState *gs, unsigned int idx)
+{
+    return Census_key (idx, gs->type [idx], gs->energy [idx], gs->memory [idx]);
+}
 
-        args->result = result;
-        args->done = 1;
-        pthread_cond_signal (&args->cond);
+/* Takes slot idx out of the counts of its player in tally, slots are taken
+ * out before they change and put back in by count_in afterwards
+ */
+static inline void
+count_out (GameState *gs, CensusTally *tally, unsigned int idx)
+{
+    uint8_t type = gs->type [idx];
 
-        pthread_mutex_unlock (&args->lock);
+    if (type == 0 || type == 255) return;
+    tally->population [type - 1]--;
+    tally->energy [type - 1] -= gs->energy [idx];
+    if (gs->census->hashing) tally->hash ^= cell_key (gs, idx);
+}
 
+/* Puts slot idx back into the counts of its player in tally
+ */
+static inline void
+count_in (GameState *gs, CensusTally *tally, unsigned int idx)
+{
+    uint8_t type = gs->type [idx];
+
+    if (type == 0 || type == 255) return;
+    tally->population [type - 1]++;
+    tally->energy [type - 1] += gs->energy [idx];
+    if (gs->census->hashing) tally->hash ^= cell_key (gs, idx);
+}
+
+/* Adds delta to the energy of slot idx on behalf of the cell in slot actor,
+ * which is counted once it is done
+ */
+static inline void
+change_energy (GameState *gs, CensusTally *tally, unsigned int idx, int delta,
+               unsigned int actor)
+{
+    if (idx != actor) count_out (gs, tally, idx);
+    gs->energy [idx] += delta;
+    if (idx != actor) count_in (gs, tally, idx);
+}
+
+/* returns the rank of slot idx in this turn's random order of deferred
+ * actions, higher ranks go first; the upper half is a hash of the turn's key
+ * and idx, the lower half idx itself, so that no two slots tie
+ */
+static inline uint64_t
+rank (GameState *gs, unsigned int idx)
+{
+    uint64_t z = gs->turn_key + (idx + 1) * 0x9e3779b97f4a7c15ull;
+
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    z ^= z >> 31;
+    return (z & ~0xffffffffull) | idx;
+}
+
+/* Deferred moves and splits are resolved as if every live cell and every
+ * target were visited once in descending order of rank: cells with less than
+ * 20 energy starve, the others carry out their action if nobody took their
+ * target before them, and a fresh split off that is visited after it was
+ * placed starves as well if it got less than 20 energy.
+ * Starvation of the source only depends on its own energy and the winner of
+ * a target is the claimant with the highest rank, so this runs in three
+ * passes over chunks of the live cells, each of which may run in parallel:
+ * resolve_claim starves cells and claims targets, resolve_commit carries out
+ * the actions of the winners and resolve_reset clears the claims again. */
+static void
+resolve_claim (GameState *gs, unsigned int chunk, int worker)
+{
+    unsigned int k, idx, target, end = (chunk + 1) * CELLHACK_CHUNK;
+    uint64_t r, old;
+    CensusTally *tally = gs->census->tallies + worker;
+
+    if (end > gs->live_cells) end = gs->live_cells;
+    for (k = chunk * CELLHACK_CHUNK; k < end; k++) {
+        idx = gs->live [k];
+        if (gs->type [idx] == 0) continue;
+
+        if (gs->energy [idx] < 20) {
+            count_out (gs, tally, idx);
+            tally->starvations [gs->type [idx] - 1]++;
+            set_type (gs, idx, 0);
+            gs->deferred [idx] = 0;
+            continue;
+        }
+        if (gs->deferred [idx] == 0) continue;
+
+        target = neighbour (gs, idx, gs->deferred [idx] % 0x10);
+        r = rank (gs, idx);
+        old = __atomic_load_n (gs->claims + target, __ATOMIC_RELAXED);
+        while (r > old && !__atomic_compare_exchange_n (gs->claims + target, &old, r, 1,
+                                                        __ATOMIC_RELAXED,
+                                                        __ATOMIC_RELAXED));
+        // old is only left at 0 for the first of several claimants
+        if (old != 0) __atomic_store_n (&gs->census->contested, 1, __ATOMIC_RELAXED);
     }
+}
 
-error:
-    return NULL;
+static void
+resolve_commit (GameState *gs, unsigned int chunk, int worker)
+{
+    unsigned int k, idx, target, end = (chunk + 1) * CELLHACK_CHUNK;
+    uint8_t action;
+    uint64_t r;
+    CensusTally *tally = gs->census->tallies + worker;
+
+    if (end > gs->live_cells) end = gs->live_cells;
+    for (k = chunk * CELLHACK_CHUNK; k < end; k++) {
+        idx = gs->live [k];
+        action = gs->deferred [idx];
+        if (action == 0) continue;
+
+        target = neighbour (gs, idx, action % 0x10);
+        r = rank (gs, idx);
+        // somebody else got there first
+        if (__atomic_load_n (gs->claims + target, __ATOMIC_RELAXED) != r) continue;
+
+        // targets were empty, so only the source needs to be taken out
+        count_out (gs, tally, idx);
+        switch (action / 0x10) {
+            case 2: // move
+
+                gs->energy [target] = gs->energy [idx];
+                gs->memory [target] = gs->memory [idx];
+                set_type (gs, target, gs->type [idx]);
+                set_type (gs, idx, 0);
+                break;
+
+            case 3: // split
+
+                gs->energy [idx] /= 2;
+                gs->energy [target] = gs->energy [idx];
+                gs->memory [target] = gs->memory [idx];
+                if (gs->energy [target] < 20) {
+                    // whether it survives depends on this turn's order
+                    __atomic_store_n (&gs->census->contested, 1, __ATOMIC_RELAXED);
+                }
+                if (gs->energy [target] >= 20 || rank (gs, target) > r) {
+                    set_type (gs, target, gs->type [idx]);
+                    tally->births [gs->type [idx] - 1]++;
+                }
+                break;
+        }
+        count_in (gs, tally, idx);
+        count_in (gs, tally, target);
+    }
 }
 
+static void
+resolve_reset (GameState *gs, unsigned int chunk, int worker)
+{
+    unsigned int k, idx, end = (chunk + 1) * CELLHACK_CHUNK;
+    (void) worker;
+
+    if (end > gs->live_cells) end = gs->live_cells;
+    for (k = chunk * CELLHACK_CHUNK; k < end; k++) {
+        idx = gs->live [k];
+        if (gs->deferred [idx] == 0) continue;
+
+        __atomic_store_n (gs->claims + neighbour (gs, idx, gs->deferred [idx] % 0x10),
+                          0, __ATOMIC_RELAXED);
+        gs->deferred [idx] = 0;
+    }
+}
+
+/* Runs one resolver pass over all live cells, on the executors if there are
+ * any
+ * returns 0 on success, 1 on error */
+static int
+resolve (GameState *gs, ExecutorTask pass)
+{
+    unsigned int chunk, chunks = (gs->live_cells + CELLHACK_CHUNK - 1) / CELLHACK_CHUNK;
+
+    if (gs->pool) return ExecutorPool_run (gs->pool, chunks, pass, gs, NULL);
 
-/* returns an integer from 0 to max exclusive */
-unsigned int
-randint (unsigned int max)
+    for (chunk = 0; chunk < chunks; chunk++) {
+        pass (gs, chunk, 0);
+    }
+    return 0;
+}
+
+/* Records the board of the current turn and sets stopped to the first of
+ * the stop conditions that holds */
+static void
+check_stop (GameState *gs)
 {
-    return rand () % max; // can't be arsed about modulo bias just yet
+    int n, alive = 0, cycle;
+
+    cycle = Census_record (gs->census, gs->turns);
+    for (n = 0; n < gs->num; n++) {
+        if (gs->census->population [n] > 0) alive++;
+    }
+
+    gs->stopped = 0;
+    if ((gs->stop & CELLHACK_STOP_EXTINCT) && alive == 0) {
+        gs->stopped = CELLHACK_STOP_EXTINCT;
+    } else if ((gs->stop & CELLHACK_STOP_SURVIVOR) && gs->num > 1 && alive == 1) {
+        gs->stopped = CELLHACK_STOP_SURVIVOR;
+    } else if ((gs->stop & CELLHACK_STOP_CYCLE) && cycle) {
+        gs->stopped = CELLHACK_STOP_CYCLE;
+    }
 }
 
 
 GameState*
 CellHack_init (int width, int height, int num, unsigned int timeout,
                CellHack_decide_action* ai, char** names)
+{
+    CellHackConfig config = {
+        .threads = 1,
+        .standby = 1,
+        .budget  = timeout * 1000000ul,
+        .timeout = timeout
+    };
+
+    return CellHack_init_config (width, height, num, ai, names, &config);
+}
+
+GameState*
+CellHack_init_config (int width, int height, int num,
+                      CellHack_decide_action* ai, char** names,
+                      CellHackConfig *config)
 {
     GameState *gs = NULL;
-    int err = 0;
+    int n, hashing;
     check (num > 0, "Must load at least one cell faction.");
+    check (config != NULL, "Got NULL as config.");
 
     // all starting cells are arranged in a square
     // number of starting cells per side of the square is
@@ -68,56 +338,143 @@ CellHack_init (int width, int height, int num, unsigned int timeout,
 
     gs = calloc (1, sizeof (GameState));
     check (gs != NULL, "Failed to alloc memory for game state.");
+    gs->width  = width;
+    gs->height = height;
+    gs->num    = num;
 
     gs->ai = calloc (num, sizeof (CellHack_decide_action));
     check (gs->ai != NULL, "Failed to alloc ai array.");
     memcpy (gs->ai, ai, num * sizeof (CellHack_decide_action));
 
+    gs->batch_ai = calloc (num, sizeof (CellHack_decide_actions_batch));
+    check (gs->batch_ai != NULL, "Failed to alloc batch ai array.");
+    if (config->batch_ai) {
+        memcpy (gs->batch_ai, config->batch_ai, num * sizeof (CellHack_decide_actions_batch));
+    }
+
+    gs->memo = calloc (num, sizeof (Memo *));
+    check (gs->memo != NULL, "Failed to alloc decision caches.");
+
     gs->names = calloc (num, sizeof (char*));
     check (gs->names != NULL, "Failed to alloc names array.");
     memcpy (gs->names, names, num * sizeof (char*));
 
-    gs->cells = calloc (width * height, sizeof (Cell));
-    check (gs->cells != NULL, "Failed to alloc playing field.");
+    gs->type = calloc (width * height, sizeof (uint8_t));
+    check (gs->type != NULL, "Failed to alloc playing field.");
 
-    gs->ea = calloc (1, sizeof (ExecutorArgs));
-    check (gs->ea != NULL, "Failed to alloc executor arguments.");
+    gs->energy = calloc (width * height, sizeof (uint8_t));
+    check (gs->energy != NULL, "Failed to alloc energy plane.");
 
-    err = pthread_mutex_init (&gs->ea->lock, NULL);
-    check (err == 0, "Failed to init mutex.");
+    gs->memory = calloc (width * height, sizeof (uint64_t));
+    check (gs->memory != NULL, "Failed to alloc memory plane.");
 
-    pthread_condattr_t cond_attr;
-    pthread_condattr_init (&cond_attr);
-    pthread_condattr_setclock (&cond_attr, CLOCK_REALTIME);
-    err = pthread_cond_init (&gs->ea->cond, &cond_attr);
-    check (err == 0, "Failed to init condition.");
+    gs->deferred = calloc (width * height, sizeof (uint8_t));
+    check (gs->deferred != NULL, "Failed to alloc deferred action plane.");
 
-    err = pthread_barrier_init (&gs->ea->barrier, NULL, 2);
-    check (err == 0, "Failt to init barrier.");
+    gs->occupied = calloc ((width * height + 63) / 64, sizeof (uint64_t));
+    check (gs->occupied != NULL, "Failed to alloc occupancy bitmap.");
 
-    err = pthread_create (&gs->etid, NULL, (void *(*)(void *)) Executor, gs->ea);
-    check (err == 0, "Failed to create executor thread.");
+    gs->claims = calloc (width * height, sizeof (uint64_t));
+    check (gs->claims != NULL, "Failed to alloc claims of targets.");
 
-    gs->width  = width;
-    gs->height = height;
-    gs->timeout = timeout;
-
-    int i, j, di, dj, ei, ej, n;
-    for (i = 0; i < width; i++) {
-        for (j = 0; j < height; j++) {
-            for (dj = -1, n = 0; dj <= 1; dj++) {
-                for (di = -1; di <= 1; di++, n++) {
-                    ei = (i + di) % width;
-                    ej = (j + dj) % height;
-                    if (ei < 0) ei = width - 1;
-                    if (ej < 0) ej = height - 1;
-                    gs->cells [i + width * j].neighbours [n] =
-                         (gs->cells + ei + ej * width);
-                }
-            }
+    // all buffers that only live for the duration of a tick come from one
+    // arena
+    size_t rows_size = 3 * (width + 2 + ENVIRONMENT_OVERREAD);
+    size_t scratch_size = width * height * (sizeof (unsigned int) + 9
+                                            + sizeof (uint8_t) + sizeof (unsigned int)
+                                            + sizeof (uint8_t))
+                          + rows_size + 6 * SCRATCH_ALIGN;
+    gs->scratch = Scratch_create (scratch_size, config->hugepages);
+    check (gs->scratch != NULL, "Failed to create scratch arena.");
+
+    gs->live = Scratch_alloc (gs->scratch, width * height * sizeof (unsigned int));
+    check (gs->live != NULL, "Failed to alloc live cell list.");
+
+    gs->env = Scratch_alloc (gs->scratch, width * height * 9 * sizeof (uint8_t));
+    check (gs->env != NULL, "Failed to alloc environment buffer.");
+
+    gs->live_neighbours = Scratch_alloc (gs->scratch, width * height * sizeof (uint8_t));
+    check (gs->live_neighbours != NULL, "Failed to alloc neighbour counts.");
+
+    gs->rows = Scratch_alloc (gs->scratch, rows_size);
+    check (gs->rows != NULL, "Failed to alloc row buffer.");
+    // the overread bytes are loaded but never used, keep them defined anyway
+    memset (gs->rows, 0, rows_size);
+
+    gs->work = Scratch_alloc (gs->scratch, width * height * sizeof (unsigned int));
+    check (gs->work != NULL, "Failed to alloc work list.");
+
+    gs->actions = Scratch_alloc (gs->scratch, width * height * sizeof (uint8_t));
+    check (gs->actions != NULL, "Failed to alloc action array.");
+
+    gs->batch_start = calloc (num + 1, sizeof (unsigned int));
+    check (gs->batch_start != NULL, "Failed to alloc batch offsets.");
+
+    // every player can add one chunk that is not full
+    gs->chunk_start = calloc (width * height / CELLHACK_CHUNK + num + 1,
+                              sizeof (unsigned int));
+    check (gs->chunk_start != NULL, "Failed to alloc chunk offsets.");
+
+    gs->chunk_player = calloc (width * height / CELLHACK_CHUNK + num,
+                               sizeof (uint8_t));
+    check (gs->chunk_player != NULL, "Failed to alloc chunk owners.");
+
+    gs->budget.cpu_limit  = config->budget * 1000;
+    gs->budget.wall_limit = config->timeout * 1000000000ul;
+    gs->budget.accounts   = num;
+    gs->budget.chunk_account = gs->chunk_player;
+
+    gs->budget.spent = calloc (num, sizeof (uint64_t));
+    check (gs->budget.spent != NULL, "Failed to alloc CPU time counters.");
+
+    gs->budget.exceeded = calloc (num, sizeof (uint8_t));
+    check (gs->budget.exceeded != NULL, "Failed to alloc timeout flags.");
+
+    if (config->sandbox) {
+        gs->sandbox = Sandbox_create (num, gs->ai, gs->batch_ai, config->pure);
+        check (gs->sandbox != NULL, "Failed to start worker processes.");
+        for (n = 0; n < num; n++) {
+            gs->sandbox->rings [n]->profile = config->profile != 0;
+        }
+    } else {
+        gs->pool = ExecutorPool_create (config->threads, config->standby);
+        check (gs->pool != NULL, "Failed to create executor pool.");
+
+        for (n = 0; n < num && config->pure; n++) {
+            if (!config->pure [n]) continue;
+            gs->memo [n] = Memo_create (MEMO_BITS);
+            check (gs->memo [n] != NULL, "Failed to create decision cache.");
         }
     }
 
+    // cycles can only be told apart from boards that happen to repeat if
+    // every player decides the same given the same cells
+    hashing = (config->stop & CELLHACK_STOP_CYCLE) != 0;
+    for (n = 0; n < num && hashing; n++) {
+        hashing = config->pure && config->pure [n];
+    }
+    if ((config->stop & CELLHACK_STOP_CYCLE) && !hashing) {
+        log_info ("Not looking for cycles, not all players are pure.");
+    }
+    gs->stop = config->stop & (hashing ? ~0 : ~CELLHACK_STOP_CYCLE);
+
+    gs->census = Census_create (num, gs->pool ? gs->pool->size : 1, hashing);
+    check (gs->census != NULL, "Failed to create census.");
+
+    if (hashing) {
+        gs->memory_before = calloc (width * height, sizeof (uint64_t));
+        check (gs->memory_before != NULL, "Failed to alloc memory copies.");
+    }
+
+    if (config->profile) {
+        // workers of the sandbox keep their decision histograms in its rings
+        gs->profile = Profile_create (num, gs->pool ? gs->pool->size : 0);
+        check (gs->profile != NULL, "Failed to create profile.");
+    }
+
+    Rng_seed (&gs->rng, config->seed);
+
+    int i, j;
     int w_step = (int) floorf ((float) width  / side_length);
     int h_step = (int) floorf ((float) height / side_length);
     int idx;
@@ -127,10 +484,11 @@ CellHack_init (int width, int height, int num, unsigned int timeout,
             if (n >= num) break;
             idx =  i * w_step + w_step / 2
                 + (j * h_step + h_step / 2) * width;
-            gs->cells [idx].type = n + 1;
-            gs->cells [idx].energy = 100;
+            set_type (gs, idx, n + 1);
+            gs->energy [idx] = 100;
         }
     }
+    CellHack_recount (gs);
 
     return gs;
 error:
@@ -141,83 +499,225 @@ error:
 void
 CellHack_destroy (GameState *gs)
 {
+    int n;
+
     if (!gs) return;
-    if (gs->cells) free (gs->cells);
+    if (gs->pool)  ExecutorPool_destroy (gs->pool);
+    if (gs->sandbox) Sandbox_destroy (gs->sandbox);
+    if (gs->type)   free (gs->type);
+    if (gs->energy) free (gs->energy);
+    if (gs->memory) free (gs->memory);
+    if (gs->deferred) free (gs->deferred);
+    if (gs->occupied) free (gs->occupied);
+    if (gs->claims) free (gs->claims);
+    if (gs->batch_start)  free (gs->batch_start);
+    if (gs->chunk_start)  free (gs->chunk_start);
+    if (gs->chunk_player) free (gs->chunk_player);
+    if (gs->scratch) Scratch_destroy (gs->scratch);
+    if (gs->budget.spent)    free (gs->budget.spent);
+    if (gs->budget.exceeded) free (gs->budget.exceeded);
     if (gs->names) free (gs->names);
     if (gs->ai)    free (gs->ai);
+    if (gs->batch_ai) free (gs->batch_ai);
+    for (n = 0; gs->memo && n < gs->num; n++) {
+        Memo_destroy (gs->memo [n]);
+    }
+    if (gs->memo) free (gs->memo);
+    if (gs->profile) Profile_destroy (gs->profile);
+    if (gs->census)  Census_destroy (gs->census);
+    if (gs->memory_before) free (gs->memory_before);
     if (gs)        free (gs);
 }
 
 void
-CellHack_tick (GameState *gs)
+CellHack_recount (GameState *gs)
 {
-    int err;
-#ifndef DEBUG
-    struct timespec ts;
-#endif
-    unsigned int temp, max_cells = gs->width * gs->height;
-    unsigned int queue [max_cells];
+    unsigned int idx, cells = gs->width * gs->height;
+    Census *census = gs->census;
+
+    memset (gs->occupied, 0, (cells + 63) / 64 * sizeof (uint64_t));
+    memset (census->population, 0, gs->num * sizeof (unsigned int));
+    memset (census->energy, 0, gs->num * sizeof (uint64_t));
+    census->hash = 0;
+    for (idx = 0; idx < cells; idx++) {
+        if (gs->type [idx] == 0 || gs->type [idx] == 255) continue;
+        gs->occupied [idx / 64] |= 1ull << (idx % 64);
+        census->population [gs->type [idx] - 1]++;
+        census->energy [gs->type [idx] - 1] += gs->energy [idx];
+        if (census->hashing) census->hash ^= cell_key (gs, idx);
+    }
 
-    check (gs != NULL, "Got NULL as game state.");
-    gs->turns += 1;
+    Census_reset (census);
+    check_stop (gs);
+}
+
+const char *
+CellHack_stop_reason (int stopped)
+{
+    switch (stopped) {
+        case CELLHACK_STOP_EXTINCT:  return "all cells died";
+        case CELLHACK_STOP_SURVIVOR: return "only one player has cells left";
+        case CELLHACK_STOP_CYCLE:    return "the board repeats";
+        default:                     return "running";
+    }
+}
 
-    uint8_t action, action_base, action_dir, live_neighbours;
-    Cell* cell = NULL;
-    int n, i;
-    for (i = 0; i < gs->width * gs->height; i++) {
-        queue [i] = i;
-        cell = gs->cells + i;
-        if (cell->type == 0 || cell->type == 255) continue;
-
-        live_neighbours = 0;
-        for (n = 0; n < 9; n++) {
-            cell->env [n] = cell->neighbours [n]->type;
-            if (cell->env [n] != 0 || cell->env [n] == 255) {
-                live_neighbours++;
-            }
+int
+CellHack_parse_stop (const char *letters)
+{
+    int stop = 0;
+
+    for (; *letters; letters++) {
+        switch (*letters) {
+            case 'x': stop |= CELLHACK_STOP_EXTINCT;  break;
+            case 's': stop |= CELLHACK_STOP_SURVIVOR; break;
+            case 'c': stop |= CELLHACK_STOP_CYCLE;    break;
+            case '-': break;
+            default:  return -1;
         }
+    }
 
-        pthread_mutex_lock (&gs->ea->lock);
+    return stop;
+}
 
-        gs->ea->arg_cell = cell;
-        gs->ea->work = gs->ai [cell->type - 1];
+int
+CellHack_standings (GameState *gs, int turns, unsigned int *cells)
+{
+    return Census_project (gs->census, gs->turns, turns, cells);
+}
 
-#ifndef DEBUG
-        err = clock_gettime (CLOCK_REALTIME, &ts);
-        check (err == 0, "Failed to get clock time, bailing.");
+void
+CellHack_decision_stats (GameState *gs, int n, ProfileHist *decisions)
+{
+    int w;
 
-        ts.tv_sec += gs->timeout;
-#endif
+    if (!gs->profile) return;
+    if (gs->sandbox) {
+        Profile_merge (decisions, &gs->sandbox->rings [n]->decisions);
+    }
+    for (w = 0; w < gs->profile->workers; w++) {
+        Profile_merge (decisions, gs->profile->decisions + w * gs->num + n);
+    }
+}
 
-        pthread_barrier_wait (&gs->ea->barrier);
+void
+CellHack_memo_stats (GameState *gs, int n, uint64_t *hits, uint64_t *misses)
+{
+    *hits = *misses = 0;
+    if (gs->sandbox) {
+        *hits   = __atomic_load_n (&gs->sandbox->rings [n]->hits, __ATOMIC_RELAXED);
+        *misses = __atomic_load_n (&gs->sandbox->rings [n]->misses, __ATOMIC_RELAXED);
+    } else if (gs->memo [n]) {
+        *hits   = Memo_hits (gs->memo [n]);
+        *misses = Memo_misses (gs->memo [n]);
+    }
+}
 
-        do {
-#ifndef DEBUG
-            err = pthread_cond_timedwait (&gs->ea->cond, &gs->ea->lock, &ts);
-#else
-            err = pthread_cond_wait (&gs->ea->cond, &gs->ea->lock);
-#endif
-        } while (gs->ea->done == 0 && err == 0);
+void
+CellHack_tick (GameState *gs)
+{
+    int err;
+    unsigned int k;
+    ExecutorBudget *budget = NULL;
+    uint64_t start = 0, now;
+    Census *census;
+    // the actions are applied in order, so any executor's tally will do
+    CensusTally *tally;
 
-        if (err == ETIMEDOUT) {
-            log_info ("Player %s timed out.", gs->names [cell->type - 1]);
+    check (gs != NULL, "Got NULL as game state.");
+    census = gs->census;
+    tally  = census->tallies;
+    if (gs->profile) start = Profile_now ();
+    gs->turns += 1;
 
-            pthread_cancel (gs->etid);
-            pthread_mutex_unlock (&gs->ea->lock);
+    uint8_t action, action_base, action_dir, live_neighbours, *env;
+    unsigned int idx;
+    int n;
+
+    // gather the environment of every live cell and count the cells of
+    // every player
+    gs->live_cells = Environment_gather (gs);
+    memset (gs->batch_start, 0, (gs->num + 1) * sizeof (unsigned int));
+    for (k = 0; k < gs->live_cells; k++) {
+        // cells keep doing nothing unless their player decides in time
+        gs->actions [k] = 2;
+        gs->batch_start [gs->type [gs->live [k]]]++;
+    }
+    if (census->hashing) {
+        for (k = 0; k < gs->live_cells; k++) {
+            gs->memory_before [k] = gs->memory [gs->live [k]];
+        }
+    }
 
-            err = pthread_create (&(gs->etid), NULL, (void *(*)(void *)) Executor, gs->ea);
-            check (err == 0, "Failed to recreate executor thread.");
+    // sort the cells into one contiguous batch per player
+    for (n = 0; n < gs->num; n++) {
+        gs->batch_start [n + 1] += gs->batch_start [n];
+    }
+    for (k = 0; k < gs->live_cells; k++) {
+        gs->work [gs->batch_start [gs->type [gs->live [k]] - 1]++] = k;
+    }
+    // batch_start [n] now points one past the last cell of player n, shift it
+    // by one so that it points to the first
+    memmove (gs->batch_start + 1, gs->batch_start, gs->num * sizeof (unsigned int));
+    gs->batch_start [0] = 0;
+
+    // cut every player's batch into chunks
+    gs->chunks = 0;
+    for (n = 0; n < gs->num; n++) {
+        for (k = gs->batch_start [n]; k < gs->batch_start [n + 1]; k += CELLHACK_CHUNK) {
+            gs->chunk_start [gs->chunks]  = k;
+            gs->chunk_player [gs->chunks] = n;
+            gs->chunks++;
+        }
+    }
+    gs->chunk_start [gs->chunks] = gs->batch_start [gs->num];
+    if (gs->profile) {
+        now = Profile_now ();
+        Profile_record (gs->profile->phases + PROFILE_GATHER, now - start);
+        start = now;
+    }
 
-            action = 2;
-        } else
-        if (err == 0) {
-            action = gs->ea->result;
-            gs->ea->done = 0;
+#ifndef DEBUG
+    budget = &gs->budget;
+#endif
+    if (gs->sandbox) {
+        err = Sandbox_run (gs->sandbox, gs, budget);
+        check (err == 0, "Failed to run worker processes.");
+    } else {
+        err = ExecutorPool_run (gs->pool, gs->chunks, (ExecutorTask) decide_chunk,
+                                gs, budget);
+        check (err == 0, "Failed to run executors.");
+    }
 
-            pthread_mutex_unlock (&gs->ea->lock);
-        } else {
-            sentinel ("Error while waiting on condition.");
+    for (n = 0; n < gs->num && budget; n++) {
+        if (budget->exceeded [n]) {
+            log_info ("Player %s timed out.", gs->names [n]);
+            if (gs->profile) gs->profile->timeouts [n]++;
+            // the cells it did not decide on depend on timing
+            census->contested = 1;
         }
+    }
+    // players changed memories without the hash seeing it
+    for (k = 0; k < gs->live_cells && census->hashing; k++) {
+        idx = gs->live [k];
+        if (gs->memory [idx] == gs->memory_before [k]) continue;
+        census->hash ^= Census_key (idx, gs->type [idx], gs->energy [idx], gs->memory_before [k])
+                        ^ cell_key (gs, idx);
+    }
+    if (gs->profile) {
+        now = Profile_now ();
+        Profile_record (gs->profile->phases + PROFILE_DECIDE, now - start);
+        start = now;
+    }
+
+    for (k = 0; k < gs->live_cells; k++) {
+        idx = gs->live [k];
+        env = gs->env + 9 * k;
+        live_neighbours = gs->live_neighbours [k];
+
+        action = gs->actions [k];
+        gs->deferred [idx] = 0;
+        count_out (gs, tally, idx);
 
         action_base = action / 0x10;
         action_dir  = action % 0x10;
@@ -226,16 +726,17 @@ CellHack_tick (GameState *gs)
 
                 switch (action_dir) {
                     case 1: // rest
-                        cell->energy += (live_neighbours >= 3) ? 7 - 2 * live_neighbours
-                                                               : 1;
-                        if (cell->energy > 200) {
-                            cell->energy = 200;
+                        gs->energy [idx] += (live_neighbours >= 3) ? 7 - 2 * live_neighbours
+                                                                   : 1;
+                        if (gs->energy [idx] > 200) {
+                            gs->energy [idx] = 200;
                         }
                         break;
                     case 2: // nothing
                         break;
                     case 3: // die
-                        cell->type = 0;
+                        tally->deaths [gs->type [idx] - 1]++;
+                        set_type (gs, idx, 0);
                         break;
                     default:
                         goto invalid;
@@ -244,84 +745,59 @@ CellHack_tick (GameState *gs)
             case 1: // eat
 
                 if (action_dir >= 9) goto invalid;
-                if (cell->env [action_dir] != 0 && cell->env [action_dir] != 255) {
-                    cell->energy += 1;
-                    cell->neighbours [action_dir]->energy -= 1;
+                if (env [action_dir] != 0 && env [action_dir] != 255) {
+                    gs->energy [idx] += 1;
+                    change_energy (gs, tally, neighbour (gs, idx, action_dir), -1, idx);
                 }
                 break;
 
             case 2: // move
             case 3: // split
                 // both actions' execution is deferred until after all others
-                // are evaluated
-                cell->deferred_action = action;
+                // are evaluated, both need an empty target
+                if (action_dir >= 9) goto invalid;
+                if (env [action_dir] == 0) {
+                    gs->deferred [idx] = action;
+                }
                 break;
 
             case 4: // feed -- reverse eat
 
                 if (action_dir >= 9) goto invalid;
-                if (cell->env [action_dir] != 0 && cell->env [action_dir] != 255) {
-                    cell->energy -= 1;
-                    cell->neighbours [action_dir]->energy += 1;
+                if (env [action_dir] != 0 && env [action_dir] != 255) {
+                    gs->energy [idx] -= 1;
+                    change_energy (gs, tally, neighbour (gs, idx, action_dir), 1, idx);
                 }
                 break;
 
             default:
             invalid:
-                log_info ("player %s: invalid command", gs->names [cell->type - 1]);
+                log_info ("player %s: invalid command", gs->names [env [4] - 1]);
         }
+        count_in (gs, tally, idx);
     }
 
-    while (max_cells > 0) {
-        i = randint (max_cells);
-        cell = gs->cells + queue [i];
-
-        temp = queue [max_cells - 1];
-        queue [max_cells - 1] = queue [i];
-        queue [i] = temp;
-        max_cells -= 1;
-
-        if (cell->energy < 20) {
-            cell->type = 0;
-            continue;
-        }
-
-        action = cell->deferred_action;
-        switch (action / 0x10) {
-            case 0: // nothing left to do
-                break;
-
-            case 2: // move
-
-                cell->deferred_action = 0;
-                action_dir  = action % 0x10;
-
-                if (action_dir >= 9) goto invalid;
-                if (cell->env [action_dir] == 0) {
-                    cell->neighbours [action_dir]->type = cell->type;
-                    cell->neighbours [action_dir]->energy = cell->energy;
-                    cell->neighbours [action_dir]->memory = cell->memory;
-                    cell->type = 0;
-                }
-                break;
-
-            case 3: // split
-
-                cell->deferred_action = 0;
-                action_dir  = action % 0x10;
-
-                if (action_dir >= 9) goto invalid;
-                if (cell->env [action_dir] == 0) {
-                    cell->energy /= 2;
-                    cell->neighbours [action_dir]->type = cell->type;
-                    cell->neighbours [action_dir]->energy = cell->energy;
-                    cell->neighbours [action_dir]->memory = cell->memory;
-                }
-                break;
-        }
-
+    if (gs->profile) {
+        now = Profile_now ();
+        Profile_record (gs->profile->phases + PROFILE_APPLY, now - start);
+        start = now;
     }
 
+    // targets were empty at the start of the turn and only live cells have
+    // deferred actions, so no action can depend on another one's outcome
+    // except through competing for the same target
+    gs->turn_key = Rng_next (&gs->rng);
+    err = resolve (gs, (ExecutorTask) resolve_claim);
+    check (err == 0, "Failed to claim targets of deferred actions.");
+    err = resolve (gs, (ExecutorTask) resolve_commit);
+    check (err == 0, "Failed to carry out deferred actions.");
+    err = resolve (gs, (ExecutorTask) resolve_reset);
+    check (err == 0, "Failed to reset claims of deferred actions.");
+    Census_fold (census);
+    check_stop (gs);
+    if (gs->profile) {
+        Profile_record (gs->profile->phases + PROFILE_RESOLVE, Profile_now () - start);
+    }
 
 error:
     return;
@@ -10,59 +10,208 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+#include "census.h"
 #include "dbg.h"
+#include "pool.h"
+#include "profile.h"
+#include "rng.h"
+#include "scratch.h"
 
 typedef uint8_t (*CellHack_decide_action) (uint8_t *env, uint8_t energy, uint64_t *memory);
+// optional entry point deciding on count cells at once, see player.h
+typedef void (*CellHack_decide_actions_batch) (unsigned int count, uint8_t *env,
+                                               uint8_t *energy, uint64_t *memory,
+                                               uint8_t *action);
 
-typedef struct Cell {
-    // what kind of cell this is, either faction (index into GameState->ai) or 0 for "empty".
-    uint8_t type;
-    // action, which will be evaluated after other actions (move or split)
-    uint8_t deferred_action;
-    // how much energy points this cell has
-    uint8_t energy;
-    // tiny amount of persistent memory each cell has
-    uint64_t memory;
-    // pointers to (the types) immediate neighbours
-    uint8_t env[9];
-    struct Cell* neighbours[9];
-} Cell;
+// maximum number of cells an executor decides on in one go
+#define CELLHACK_CHUNK 256
+
+// conditions under which a game may stop early, see CellHackConfig.stop
+// no cell is left, the rest of the game is known
+#define CELLHACK_STOP_EXTINCT  1
+// the cells of only one player are left, with more than one player; they may
+// still die out before the last turn, so neither the winner nor any count of
+// cells is known
+#define CELLHACK_STOP_SURVIVOR 2
+// the board repeats that of an earlier turn, the rest of the game is known
+#define CELLHACK_STOP_CYCLE    4
 
 typedef struct {
-    pthread_cond_t cond;
-    pthread_mutex_t lock;
-    pthread_barrier_t barrier;
+    // number of executor threads deciding on cell actions in parallel
+    int threads;
+    // number of spare executors kept ready to replace cancelled ones
+    int standby;
+    // microseconds of CPU time a player may spend on all its cells per turn
+    unsigned long budget;
+    // seconds a player may block in one call without using CPU time
     unsigned int timeout;
-    CellHack_decide_action work;
-    Cell *arg_cell;
-    uint8_t done;
-    uint8_t result;
-} ExecutorArgs;
+    // run every player in its own worker process instead of executor threads
+    int sandbox;
+    // back the scratch arena with huge pages if the field is big enough
+    int hugepages;
+    // seed of the game's random number generator, games with the same seed,
+    // players and settings play out the same
+    uint64_t seed;
+    // batch entry points of the players, NULL or one per player, NULL for
+    // players that decide cell by cell
+    CellHack_decide_actions_batch *batch_ai;
+    // NULL or one flag per player, players flagged promise that their
+    // decisions depend on nothing but their arguments and get their decisions
+    // cached, see player.h
+    const int *pure;
+    // time the phases of every tick and every call of a player, see
+    // CellHack_profile
+    int profile;
+    // CELLHACK_STOP_* conditions CellHack_stopped reports, cycles are only
+    // looked for if all players are pure since the boards of others can
+    // repeat without their cells' decisions doing so
+    int stop;
+} CellHackConfig;
+
+struct Memo;
+struct Sandbox;
 
 typedef struct {
     int width;
     int height;
-    Cell* cells;
+    // the playing field is stored as one plane per property, cell (x, y) is
+    // at index x + y * width in each of them
+    // what kind of cell this is, either faction (index into ai plus one) or
+    // 0 for "empty"
+    uint8_t *type;
+    // how much energy points this cell has
+    uint8_t *energy;
+    // tiny amount of persistent memory each cell has
+    uint64_t *memory;
+    // action, which will be evaluated after other actions (move or split)
+    uint8_t *deferred;
+    // one bit per slot, set where type holds a live cell, bit idx % 64 of word
+    // idx / 64 belongs to cell idx; kept in sync with type by every action
+    // that places or removes cells
+    uint64_t *occupied;
+    // rank of the strongest cell that wants to move or split into every slot
+    // this turn, 0 everywhere outside of resolving deferred actions
+    uint64_t *claims;
     CellHack_decide_action* ai;
+    // NULL for players without a batch entry point
+    CellHack_decide_actions_batch *batch_ai;
+    // decision cache of every pure player, NULL for the others and for all
+    // players if they run in worker processes, which keep caches of their own
+    struct Memo **memo;
     char** names;
     int turns;
-    ExecutorArgs *ea;
-    unsigned int timeout;
-    pthread_t etid;
+    int num;
+    // indices of all live cells at the start of the turn in ascending order,
+    // their environments and their number of non-empty environment slots,
+    // env + 9 * k and live_neighbours [k] belong to cell live [k]
+    unsigned int *live;
+    unsigned int live_cells;
+    uint8_t *env;
+    uint8_t *live_neighbours;
+    // three padded rows of the type plane used while gathering environments
+    uint8_t *rows;
+    // positions in live grouped by player, player n owns
+    // work [batch_start [n]] … work [batch_start [n + 1] - 1]
+    unsigned int *work;
+    unsigned int *batch_start;
+    // the work list is split into chunks which never span two players,
+    // chunk k covers work [chunk_start [k]] … work [chunk_start [k + 1] - 1]
+    unsigned int *chunk_start;
+    uint8_t *chunk_player;
+    unsigned int chunks;
+    // chosen action for every live cell, indexed like live
+    uint8_t *actions;
+    // per player time budget, budget.exceeded is set for players that ran
+    // out of time in the current turn
+    ExecutorBudget budget;
+    ExecutorPool *pool;
+    // NULL unless players run in worker processes
+    struct Sandbox *sandbox;
+    // holds live, env, live_neighbours, rows, work and actions
+    Scratch *scratch;
+    Rng rng;
+    // drawn from rng every turn, decides which deferred actions go first
+    uint64_t turn_key;
+    // NULL unless profiling
+    Profile *profile;
+    // live cells, energy, births, deaths and starvations of every player and
+    // the board hash
+    Census *census;
+    // NULL unless the board is hashed, memories of the live cells before
+    // their players decided, indexed like live
+    uint64_t *memory_before;
+    // CELLHACK_STOP_* conditions to check after every turn and the one that
+    // held after the last, 0 if none did
+    int stop;
+    int stopped;
 } GameState;
 
 #define Cellhack_width(gs) (gs->width)
 #define Cellhack_height(gs) (gs->height)
 #define Cellhack_turns(gs) (gs->turns)
+#define Cellhack_types(gs) (gs->type)
+#define Cellhack_energies(gs) (gs->energy)
+#define Cellhack_memories(gs) (gs->memory)
 
 /* Initializes the game state
  * Makes copy of *ai and **names, so those can be freed while the game still
  * uses them */
 GameState* CellHack_init (int width, int height, int num, unsigned int timeout, CellHack_decide_action* ai, char** names);
 
+/* Same as CellHack_init, but takes the remaining settings (number of executor
+ * threads, timeout, …) from config */
+GameState* CellHack_init_config (int width, int height, int num, CellHack_decide_action* ai, char** names, CellHackConfig *config);
+
+/* Recounts the live cells and rehashes the board after the cells were
+ * changed by other means than CellHack_tick (e.g. loaded from a checkpoint),
+ * turns counts as the turn the board is from */
+void CellHack_recount (GameState *gs);
+
 /* Cleans the game's ressources up */
 void CellHack_destroy (GameState* gs);
 
 /* Computes the next game state */
 void CellHack_tick (GameState* gs);
+
+/* returns the CELLHACK_STOP_* condition that held after the last turn or 0 */
+#define CellHack_stopped(gs) ((gs)->stopped)
+
+/* return the number of live cells of player n and their total energy, both
+ * kept up to date by CellHack_tick, so reading them costs nothing */
+#define CellHack_population(gs, n) ((gs)->census->population [n])
+#define CellHack_energy(gs, n) ((gs)->census->energy [n])
+
+/* return how many cells of player n were placed by splits, died on purpose
+ * and starved since the game started or was restored, a fork keeps them */
+#define CellHack_births(gs, n) ((gs)->census->births [n])
+#define CellHack_deaths(gs, n) ((gs)->census->deaths [n])
+#define CellHack_starvations(gs, n) ((gs)->census->starvations [n])
+
+/* returns a description of a CELLHACK_STOP_* condition */
+const char *CellHack_stop_reason (int stopped);
+
+/* returns the CELLHACK_STOP_* flags for a string of condition letters (x for
+ * extinction, s for a sole survivor, c for a cycle, - for none), -1 if it
+ * holds anything else */
+int CellHack_parse_stop (const char *letters);
+
+/* Stores how many live cells every player has after turn turns to cells, one
+ * per player; turns may lie past the current turn if the board is extinct or
+ * in a cycle, the counts are exact either way
+ * returns 0 on success, 1 if the counts after turns are not known without
+ * playing on, cells then holds those of the current turn */
+int CellHack_standings (GameState *gs, int turns, unsigned int *cells);
+
+/* returns the profile of the game or NULL if it is not profiled, the
+ * decisions of players that run in worker processes are not in it but in
+ * CellHack_decision_stats */
+#define CellHack_profile(gs) ((const Profile *) (gs)->profile)
+
+/* Adds the time of every call of player n so far to decisions, which should
+ * be zeroed first; nothing is added unless the game is profiled */
+void CellHack_decision_stats (GameState *gs, int n, ProfileHist *decisions);
+
+/* Stores how many decisions of player n were answered from and missed its
+ * decision cache so far, both are 0 unless the player is pure */
+void CellHack_memo_stats (GameState *gs, int n, uint64_t *hits, uint64_t *misses);
 #endif
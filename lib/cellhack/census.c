@@ -0,0 +1,167 @@
+// Copyright 2015 Marvin Poul
+// Licensed under the Do What The Fuck You Want To License, Version 2
+// See LICENSE for details or http://www.wtfpl.net/txt/copying
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "census.h"
+#include "dbg.h"
+
+Census *
+Census_create (int num, int workers, int hashing)
+{
+    Census *census = NULL;
+    int w;
+
+    census = calloc (1, sizeof (Census));
+    check (census != NULL, "Failed to alloc census.");
+    census->num     = num;
+    census->workers = workers;
+    census->hashing = hashing;
+
+    census->population = calloc (num, sizeof (unsigned int));
+    check (census->population != NULL, "Failed to alloc population counts.");
+    census->energy = calloc (num, sizeof (uint64_t));
+    check (census->energy != NULL, "Failed to alloc energy totals.");
+    census->births = calloc (num, sizeof (uint64_t));
+    check (census->births != NULL, "Failed to alloc birth counts.");
+    census->deaths = calloc (num, sizeof (uint64_t));
+    check (census->deaths != NULL, "Failed to alloc death counts.");
+    census->starvations = calloc (num, sizeof (uint64_t));
+    check (census->starvations != NULL, "Failed to alloc starvation counts.");
+
+    census->tallies = aligned_alloc (64, workers * sizeof (CensusTally));
+    check (census->tallies != NULL, "Failed to alloc tallies.");
+    memset (census->tallies, 0, workers * sizeof (CensusTally));
+    for (w = 0; w < workers; w++) {
+        // all counters of a tally share one block
+        census->tallies [w].population = calloc (5 * num, sizeof (int64_t));
+        check (census->tallies [w].population != NULL, "Failed to alloc tally.");
+        census->tallies [w].energy      = census->tallies [w].population + num;
+        census->tallies [w].births      = (uint64_t *) census->tallies [w].population + 2 * num;
+        census->tallies [w].deaths      = (uint64_t *) census->tallies [w].population + 3 * num;
+        census->tallies [w].starvations = (uint64_t *) census->tallies [w].population + 4 * num;
+    }
+
+    if (hashing) {
+        census->hashes = calloc (CENSUS_HISTORY, sizeof (uint64_t));
+        check (census->hashes != NULL, "Failed to alloc hash history.");
+        census->contests = calloc (CENSUS_HISTORY, sizeof (uint8_t));
+        check (census->contests != NULL, "Failed to alloc contest history.");
+        census->populations = calloc (CENSUS_HISTORY * num, sizeof (unsigned int));
+        check (census->populations != NULL, "Failed to alloc population history.");
+    }
+
+    return census;
+
+error:
+    Census_destroy (census);
+    return NULL;
+}
+
+void
+Census_destroy (Census *census)
+{
+    int w;
+
+    if (!census) return;
+
+    for (w = 0; census->tallies && w < census->workers; w++) {
+        if (census->tallies [w].population) free (census->tallies [w].population);
+    }
+    if (census->tallies)     free (census->tallies);
+    if (census->population)  free (census->population);
+    if (census->energy)      free (census->energy);
+    if (census->births)      free (census->births);
+    if (census->deaths)      free (census->deaths);
+    if (census->starvations) free (census->starvations);
+    if (census->hashes)      free (census->hashes);
+    if (census->contests)    free (census->contests);
+    if (census->populations) free (census->populations);
+    free (census);
+}
+
+void
+Census_fold (Census *census)
+{
+    CensusTally *tally;
+    int w, n;
+
+    for (w = 0; w < census->workers; w++) {
+        tally = census->tallies + w;
+        census->hash ^= tally->hash;
+        tally->hash = 0;
+        for (n = 0; n < census->num; n++) {
+            census->population [n]  += tally->population [n];
+            census->energy [n]      += tally->energy [n];
+            census->births [n]      += tally->births [n];
+            census->deaths [n]      += tally->deaths [n];
+            census->starvations [n] += tally->starvations [n];
+        }
+        memset (tally->population, 0, 5 * census->num * sizeof (int64_t));
+    }
+}
+
+void
+Census_reset (Census *census)
+{
+    census->first = census->last = -1;
+    census->cycle_start = census->cycle_length = 0;
+    census->contested = 0;
+}
+
+int
+Census_record (Census *census, int turn)
+{
+    int t, slot = turn % CENSUS_HISTORY;
+
+    if (!census->hashing) return 0;
+
+    // a turn repeats an earlier one if it has the same board and nothing
+    // that happened since depended on chance
+    census->cycle_length = 0;
+    for (t = turn - 1; census->first >= 0 && t >= census->first
+                       && t > turn - CENSUS_HISTORY && !census->contested; t--) {
+        if (census->hashes [t % CENSUS_HISTORY] == census->hash) {
+            census->cycle_start  = t;
+            census->cycle_length = turn - t;
+            break;
+        }
+        // the turn before t led to it by chance, so did everything before
+        if (census->contests [t % CENSUS_HISTORY]) break;
+    }
+
+    if (census->first < 0 || census->last + 1 != turn) census->first = turn;
+    else if (turn - census->first >= CENSUS_HISTORY) census->first = turn - CENSUS_HISTORY + 1;
+    census->last = turn;
+    census->hashes [slot]   = census->hash;
+    census->contests [slot] = census->contested;
+    memcpy (census->populations + slot * census->num, census->population,
+            census->num * sizeof (unsigned int));
+    census->contested = 0;
+
+    return census->cycle_length != 0;
+}
+
+int
+Census_project (const Census *census, int now, int turns, unsigned int *cells)
+{
+    int n, turn;
+
+    if (census->cycle_length == 0 || turns <= now) {
+        memcpy (cells, census->population, census->num * sizeof (unsigned int));
+        if (turns <= now) return 0;
+        // any cell left may still grow, move or die
+        for (n = 0; n < census->num; n++) {
+            if (cells [n] > 0) return 1;
+        }
+        return 0;
+    }
+
+    // the board of turn turns is the one the cycle is at by then
+    turn = census->cycle_start + (turns - census->cycle_start) % census->cycle_length;
+    memcpy (cells, census->populations + (turn % CENSUS_HISTORY) * census->num,
+            census->num * sizeof (unsigned int));
+    return 0;
+}
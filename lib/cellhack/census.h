@@ -0,0 +1,99 @@
+// Copyright 2015 Marvin Poul
+// Licensed under the Do What The Fuck You Want To License, Version 2
+// See LICENSE for details or http://www.wtfpl.net/txt/copying
+
+#ifndef CENSUS_H
+#define CENSUS_H
+
+#include <stdint.h>
+
+// number of past turns kept to find cycles in, longer cycles go unnoticed
+#define CENSUS_HISTORY 256
+
+/* Changes made by one executor during a tick, each array has one entry per
+ * player */
+typedef struct {
+    uint64_t hash;
+    // change of the live cells and of their energy
+    int64_t *population;
+    int64_t *energy;
+    // cells placed by splits, that died on purpose and that starved
+    uint64_t *births;
+    uint64_t *deaths;
+    uint64_t *starvations;
+} __attribute__ ((aligned (64))) CensusTally;
+
+/* Counts of the live cells of a game and their energy, kept up to date by
+ * every action that changes the board instead of by scanning it, and
+ * optionally a hash of the whole board with the recent turns' hashes to find
+ * repeating boards in; each array has one entry per player */
+typedef struct Census {
+    int num;
+    // live cells and their total energy
+    unsigned int *population;
+    uint64_t *energy;
+    // totals since the game started or was restored
+    uint64_t *births;
+    uint64_t *deaths;
+    uint64_t *starvations;
+    // one per executor, folded into the counts at the end of every tick
+    CensusTally *tallies;
+    int workers;
+    // set if the board is hashed
+    int hashing;
+    // XOR of Census_key of every slot
+    uint64_t hash;
+    // set during a tick if its outcome depended on the game's random numbers
+    // (targets claimed by more than one cell) or on timing (players that ran
+    // out of time), such turns end no cycle
+    int contested;
+    // hash, contested flag and population of the last turns, turn t at
+    // t % CENSUS_HISTORY; first is the first turn recorded
+    uint64_t *hashes;
+    uint8_t *contests;
+    unsigned int *populations;
+    int first;
+    int last;
+    // first turn and length of the cycle the board is in, 0 if none was found
+    int cycle_start;
+    int cycle_length;
+} Census;
+
+/* returns a census of num players changed by up to workers executors at once,
+ * hashing the board if hashing is set, or NULL on error */
+Census *Census_create (int num, int workers, int hashing);
+
+/* Frees the census */
+void Census_destroy (Census *census);
+
+/* Adds the changes of all tallies to the counts and clears them */
+void Census_fold (Census *census);
+
+/* Forgets all turns recorded so far, e.g. after the board was replaced */
+void Census_reset (Census *census);
+
+/* Records the board after turn and looks for an earlier turn it repeats
+ * returns 1 if the board is in a cycle, 0 otherwise */
+int Census_record (Census *census, int turn);
+
+/* Stores the live cells every player has after turn turns to cells, as known
+ * at turn now: boards in a cycle are followed through it, extinct ones stay
+ * empty
+ * returns 0 on success, 1 if turns lies past now and neither holds, cells
+ * then holds the counts of turn now */
+int Census_project (const Census *census, int now, int turns, unsigned int *cells);
+
+/* returns the contribution of slot idx to the board hash, empty slots and
+ * rocks contribute nothing since they never affect what comes next */
+static inline uint64_t
+Census_key (unsigned int idx, uint8_t type, uint8_t energy, uint64_t memory)
+{
+    uint64_t z;
+
+    if (type == 0 || type == 255) return 0;
+    z = ((uint64_t) idx << 16 | (uint64_t) type << 8 | energy) * 0x9e3779b97f4a7c15ull;
+    z = ((z ^ (z >> 31)) * 0xbf58476d1ce4e5b9ull) ^ memory;
+    z = (z ^ (z >> 30)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+#endif
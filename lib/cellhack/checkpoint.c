@@ -0,0 +1,314 @@
+// Copyright 2015 Marvin Poul
+// Licensed under the Do What The Fuck You Want To License, Version 2
+// See LICENSE for details or http://www.wtfpl.net/txt/copying
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "checkpoint.h"
+#include "dbg.h"
+
+static inline uint8_t *
+put_u32 (uint8_t *dst, uint32_t v)
+{
+    int i;
+    for (i = 0; i < 4; i++) dst [i] = v >> (8 * i);
+    return dst + 4;
+}
+
+static inline uint8_t *
+put_u64 (uint8_t *dst, uint64_t v)
+{
+    int i;
+    for (i = 0; i < 8; i++) dst [i] = v >> (8 * i);
+    return dst + 8;
+}
+
+static inline uint32_t
+get_u32 (const uint8_t *src)
+{
+    return src [0] | src [1] << 8 | src [2] << 16 | (uint32_t) src [3] << 24;
+}
+
+static inline uint64_t
+get_u64 (const uint8_t *src)
+{
+    return get_u32 (src) | (uint64_t) get_u32 (src + 4) << 32;
+}
+
+static inline uint64_t
+align (uint64_t offset)
+{
+    return (offset + CHECKPOINT_ALIGN - 1) & ~(uint64_t) (CHECKPOINT_ALIGN - 1);
+}
+
+/* Pads the file with zeros from *offset to start and writes size bytes of buf
+ * there
+ * returns 0 on success, 1 on error */
+static int
+write_at (FILE *file, uint64_t *offset, uint64_t start, const void *buf, size_t size)
+{
+    static const uint8_t zeros [CHECKPOINT_ALIGN];
+    size_t written;
+
+    written = fwrite (zeros, 1, start - *offset, file);
+    check (written == start - *offset, "Failed to pad checkpoint.");
+    written = fwrite (buf, 1, size, file);
+    check (written == size, "Failed to write checkpoint.");
+    *offset = start + size;
+
+    return 0;
+
+error:
+    return 1;
+}
+
+int
+CellHack_checkpoint (GameState *gs, const char *path)
+{
+    uint8_t header [CHECKPOINT_HEADER_SIZE] = {0}, *p;
+    uint32_t order = CHECKPOINT_ORDER;
+    uint64_t cells, names_size = 0, planes [3], offset = 0;
+    char *tmp = NULL;
+    FILE *file = NULL;
+    int n, i, err;
+
+    check (gs != NULL, "Got NULL as game state.");
+    cells = (uint64_t) gs->width * gs->height;
+    for (n = 0; n < gs->num; n++) {
+        names_size += strlen (gs->names [n]) + 1;
+    }
+    planes [0] = align (CHECKPOINT_HEADER_SIZE + names_size);
+    planes [1] = align (planes [0] + cells);
+    planes [2] = align (planes [1] + cells);
+
+    memcpy (header, CHECKPOINT_MAGIC, 8);
+    p = put_u32 (header + 8, 1);
+    memcpy (p, &order, 4);
+    p = put_u32 (p + 4, gs->width);
+    p = put_u32 (p, gs->height);
+    p = put_u32 (p, gs->num);
+    p = put_u32 (p, gs->turns);
+    for (i = 0; i < 4; i++) {
+        p = put_u64 (p, gs->rng.s [i]);
+    }
+    p = put_u32 (p, names_size);
+    p = put_u32 (p, 0);
+    for (i = 0; i < 3; i++) {
+        p = put_u64 (p, planes [i]);
+    }
+
+    // written next to path and moved over it once complete, so that a crash
+    // while writing leaves the last checkpoint intact
+    tmp = malloc (strlen (path) + 5);
+    check (tmp != NULL, "Failed to alloc checkpoint path.");
+    sprintf (tmp, "%s.tmp", path);
+    file = fopen (tmp, "w");
+    check (file != NULL, "Failed to open checkpoint %s.", tmp);
+
+    err = write_at (file, &offset, 0, header, CHECKPOINT_HEADER_SIZE);
+    for (n = 0; n < gs->num && err == 0; n++) {
+        err = write_at (file, &offset, offset, gs->names [n], strlen (gs->names [n]) + 1);
+    }
+    check (err == 0, "Failed to write checkpoint header.");
+    err = write_at (file, &offset, planes [0], gs->type, cells);
+    err |= write_at (file, &offset, planes [1], gs->energy, cells);
+    err |= write_at (file, &offset, planes [2], gs->memory, cells * sizeof (uint64_t));
+    check (err == 0, "Failed to write checkpoint planes.");
+
+    err = ferror (file) | fclose (file);
+    file = NULL;
+    check (err == 0, "Failed to write checkpoint %s.", tmp);
+    err = rename (tmp, path);
+    check (err == 0, "Failed to move checkpoint to %s.", path);
+
+    free (tmp);
+    return 0;
+
+error:
+    if (file) fclose (file);
+    if (tmp) {
+        unlink (tmp);
+        free (tmp);
+    }
+    return 1;
+}
+
+/* Splits the names block into cp->num names
+ * returns 0 on success, 1 on error */
+static int
+parse_names (Checkpoint *cp, const uint8_t *block, size_t size)
+{
+    char *name;
+    int n;
+
+    check (size > 0 && block [size - 1] == '\0', "Checkpoint names are not ended.");
+    cp->name_buf = malloc (size);
+    check (cp->name_buf != NULL, "Failed to copy checkpoint names.");
+    memcpy (cp->name_buf, block, size);
+
+    cp->names = calloc (cp->num, sizeof (char *));
+    check (cp->names != NULL, "Failed to alloc player names.");
+    for (n = 0, name = cp->name_buf; n < cp->num && name < cp->name_buf + size; n++) {
+        cp->names [n] = name;
+        name += strlen (name) + 1;
+    }
+    check (n == cp->num && name == cp->name_buf + size,
+           "Checkpoint disagrees with itself on the players.");
+
+    return 0;
+
+error:
+    return 1;
+}
+
+Checkpoint *
+Checkpoint_open (const char *path)
+{
+    Checkpoint *cp = NULL;
+    struct stat st;
+    uint64_t cells, names_size, planes [3];
+    uint32_t order;
+    int fd = -1, err, i;
+
+    cp = calloc (1, sizeof (Checkpoint));
+    check (cp != NULL, "Failed to alloc checkpoint.");
+    cp->map = MAP_FAILED;
+
+    fd = open (path, O_RDONLY);
+    check (fd >= 0, "Failed to open checkpoint %s.", path);
+    err = fstat (fd, &st);
+    check (err == 0, "Failed to get size of checkpoint %s.", path);
+    check ((size_t) st.st_size >= CHECKPOINT_HEADER_SIZE, "Checkpoint %s is truncated.", path);
+
+    cp->size = st.st_size;
+    cp->map  = mmap (NULL, cp->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    check (cp->map != MAP_FAILED, "Failed to map checkpoint %s.", path);
+    close (fd);
+    fd = -1;
+
+    check (memcmp (cp->map, CHECKPOINT_MAGIC, 8) == 0, "%s is no checkpoint.", path);
+    check (get_u32 (cp->map + 8) == 1, "Unknown checkpoint version %u.",
+           get_u32 (cp->map + 8));
+    memcpy (&order, cp->map + 12, 4);
+    check (order == CHECKPOINT_ORDER, "Checkpoint was written on a machine of another byte order.");
+
+    cp->width  = get_u32 (cp->map + 16);
+    cp->height = get_u32 (cp->map + 20);
+    cp->num    = get_u32 (cp->map + 24);
+    cp->turns  = get_u32 (cp->map + 28);
+    for (i = 0; i < 4; i++) {
+        cp->rng.s [i] = get_u64 (cp->map + 32 + 8 * i);
+    }
+    names_size = get_u32 (cp->map + 64);
+    for (i = 0; i < 3; i++) {
+        planes [i] = get_u64 (cp->map + 72 + 8 * i);
+        check (planes [i] % CHECKPOINT_ALIGN == 0, "Checkpoint plane is misaligned.");
+    }
+    check (cp->width > 0 && cp->height > 0 && cp->num > 0 && cp->num < 255,
+           "Checkpoint header is corrupt.");
+
+    cells = (uint64_t) cp->width * cp->height;
+    check (CHECKPOINT_HEADER_SIZE + names_size <= planes [0]
+           && planes [0] + cells <= planes [1] && planes [1] + cells <= planes [2]
+           && planes [2] + cells * sizeof (uint64_t) <= cp->size,
+           "Checkpoint planes out of bounds.");
+    cp->types    = cp->map + planes [0];
+    cp->energies = cp->map + planes [1];
+    cp->memories = (const uint64_t *) (cp->map + planes [2]);
+
+    err = parse_names (cp, cp->map + CHECKPOINT_HEADER_SIZE, names_size);
+    check (err == 0, "Failed to read checkpoint names.");
+
+    return cp;
+
+error:
+    if (fd >= 0) close (fd);
+    Checkpoint_close (cp);
+    return NULL;
+}
+
+void
+Checkpoint_close (Checkpoint *cp)
+{
+    if (!cp) return;
+
+    if (cp->map != MAP_FAILED && cp->map) munmap ((void *) cp->map, cp->size);
+    if (cp->names)    free (cp->names);
+    if (cp->name_buf) free (cp->name_buf);
+    free (cp);
+}
+
+/* Replaces the cells and the turn of a freshly started game */
+static void
+load (GameState *gs, const uint8_t *types, const uint8_t *energies,
+      const uint64_t *memories, int turns, const Rng *rng)
+{
+    size_t cells = (size_t) gs->width * gs->height;
+
+    memcpy (gs->type, types, cells);
+    memcpy (gs->energy, energies, cells);
+    memcpy (gs->memory, memories, cells * sizeof (uint64_t));
+    gs->turns = turns;
+    gs->rng   = *rng;
+    CellHack_recount (gs);
+}
+
+GameState *
+CellHack_restore (const Checkpoint *cp, CellHack_decide_action *ai, char **names,
+                  CellHackConfig *config)
+{
+    GameState *gs = NULL;
+    size_t idx, cells;
+
+    check (cp != NULL, "Got NULL as checkpoint.");
+    cells = (size_t) cp->width * cp->height;
+    for (idx = 0; idx < cells; idx++) {
+        check (cp->types [idx] <= cp->num || cp->types [idx] == 255,
+               "Checkpoint holds cells of unknown players.");
+    }
+
+    gs = CellHack_init_config (cp->width, cp->height, cp->num, ai,
+                               names ? names : cp->names, config);
+    check (gs != NULL, "Failed to init restored game.");
+
+    load (gs, cp->types, cp->energies, cp->memories, cp->turns, &cp->rng);
+
+    return gs;
+
+error:
+    return NULL;
+}
+
+GameState *
+CellHack_fork (GameState *gs, CellHack_decide_action *ai, CellHackConfig *config)
+{
+    GameState *clone = NULL;
+    CellHackConfig forked;
+
+    check (gs != NULL, "Got NULL as game state.");
+    check (config != NULL, "Got NULL as config.");
+    forked = *config;
+    if (!ai) {
+        ai = gs->ai;
+        if (!forked.batch_ai) forked.batch_ai = gs->batch_ai;
+    }
+
+    clone = CellHack_init_config (gs->width, gs->height, gs->num, ai, gs->names, &forked);
+    check (clone != NULL, "Failed to init forked game.");
+
+    load (clone, gs->type, gs->energy, gs->memory, gs->turns, &gs->rng);
+    // a clone has the same past, unlike a restored game
+    memcpy (clone->census->births, gs->census->births, gs->num * sizeof (uint64_t));
+    memcpy (clone->census->deaths, gs->census->deaths, gs->num * sizeof (uint64_t));
+    memcpy (clone->census->starvations, gs->census->starvations, gs->num * sizeof (uint64_t));
+
+    return clone;
+
+error:
+    return NULL;
+}
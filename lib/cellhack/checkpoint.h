@@ -0,0 +1,88 @@
+// Copyright 2015 Marvin Poul
+// Licensed under the Do What The Fuck You Want To License, Version 2
+// See LICENSE for details or http://www.wtfpl.net/txt/copying
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cellhack.h"
+
+/* A checkpoint holds everything needed to continue a game from the turn it
+ * was taken: the header, all integers little endian except order
+ *  > magic       8 bytes, CHECKPOINT_MAGIC
+ *  > version     u32, 1
+ *  > order       u32, CHECKPOINT_ORDER in the byte order of the planes
+ *  > width       u32
+ *  > height      u32
+ *  > players     u32
+ *  > turns       u32
+ *  > rng         4 u64, state of the game's random number generator
+ *  > names_size  u32
+ *  > reserved    u32, 0
+ *  > types       u64, file offset of the type plane
+ *  > energies    u64, file offset of the energy plane
+ *  > memories    u64, file offset of the memory plane
+ * followed by the players' names, each ended by a \000, and the three
+ * planes of width * height cells, the memories as u64 in the byte order of
+ * the machine that wrote them. Every plane starts at a multiple of
+ * CHECKPOINT_ALIGN, so that a mapped checkpoint can be used as is. */
+
+#define CHECKPOINT_MAGIC "CHCHKPNT"
+#define CHECKPOINT_ORDER 0x01020304
+#define CHECKPOINT_HEADER_SIZE 96
+#define CHECKPOINT_ALIGN 64
+
+/* A checkpoint file mapped into memory, the planes point right into it */
+typedef struct {
+    int width;
+    int height;
+    // number of players, names [n] belongs to cell type n + 1
+    int num;
+    int turns;
+    char **names;
+    Rng rng;
+    const uint8_t *types;
+    const uint8_t *energies;
+    const uint64_t *memories;
+    // the whole file
+    const uint8_t *map;
+    size_t size;
+    // copy of the names block, names point into it
+    char *name_buf;
+} Checkpoint;
+
+/* Writes the state of gs to path, which is replaced only once the whole
+ * checkpoint was written; must not be called during a tick
+ * returns 0 on success, 1 on error */
+int CellHack_checkpoint (GameState *gs, const char *path);
+
+/* Maps the checkpoint at path and checks its header
+ * returns NULL on error */
+Checkpoint *Checkpoint_open (const char *path);
+
+/* Unmaps the checkpoint, games restored from it keep working unless they
+ * took its names */
+void Checkpoint_close (Checkpoint *cp);
+
+/* Starts a game at the turn cp was taken
+ * ai and config are used as by CellHack_init_config, ai must hold cp->num
+ * players, which need not be the ones that played so far. names may be NULL
+ * to use the checkpoint's, cp must then stay open for as long as the game.
+ * The game continues exactly as the original would have with the same
+ * players and settings.
+ * returns NULL on error */
+GameState *CellHack_restore (const Checkpoint *cp, CellHack_decide_action *ai,
+                             char **names, CellHackConfig *config);
+
+/* Clones gs in memory at its current turn, without going through a file;
+ * must not be called during a tick
+ * ai may be NULL to keep gs's players, which then keep their batch entry
+ * points unless config brings its own. Otherwise the same as
+ * CellHack_restore.
+ * returns NULL on error */
+GameState *CellHack_fork (GameState *gs, CellHack_decide_action *ai,
+                          CellHackConfig *config);
+#endif
@@ -0,0 +1,242 @@
+// Copyright 2015 Marvin Poul
+// Licensed under the Do What The Fuck You Want To License, Version 2
+// See LICENSE for details or http://www.wtfpl.net/txt/copying
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define ENVIRONMENT_X86
+#endif
+
+#include "environment.h"
+
+/* returns the n <= 32 bits of the occupancy bitmap starting at cell idx */
+static inline uint32_t
+occupied_bits (const GameState *gs, unsigned int idx, int n)
+{
+    unsigned int shift = idx % 64;
+    uint64_t bits = gs->occupied [idx / 64] >> shift;
+
+    if (shift + n > 64) bits |= gs->occupied [idx / 64 + 1] << (64 - shift);
+    return n < 32 ? (uint32_t) bits & ((1u << n) - 1) : (uint32_t) bits;
+}
+
+/* returns whether any cell in row y is occupied */
+static inline int
+row_occupied (const GameState *gs, int y)
+{
+    unsigned int lo = y * gs->width, hi = lo + gs->width - 1;
+    unsigned int w;
+    uint64_t first = ~0ull << lo % 64, last = ~0ull >> (63 - hi % 64);
+
+    if (lo / 64 == hi / 64) return (gs->occupied [lo / 64] & first & last) != 0;
+    if (gs->occupied [lo / 64] & first) return 1;
+    for (w = lo / 64 + 1; w < hi / 64; w++) {
+        if (gs->occupied [w]) return 1;
+    }
+    return (gs->occupied [hi / 64] & last) != 0;
+}
+
+/* All row functions get the rows above, at and below the current one padded
+ * by one wrapped around cell on each side, row [-1] is the last cell of the
+ * row and row [width] the first.
+ * They append the live cells of the row to gs->live, gs->env and
+ * gs->live_neighbours starting at position k and return the new number of
+ * live cells. Which cells are live is read from the occupancy bitmap, so
+ * empty stretches of the row are skipped without looking at them. */
+typedef unsigned int (*GatherRow) (GameState *gs, const uint8_t *up,
+                                   const uint8_t *mid, const uint8_t *down,
+                                   unsigned int offset, unsigned int k);
+
+static inline void
+emit (GameState *gs, const uint8_t *up, const uint8_t *mid,
+      const uint8_t *down, int x, unsigned int offset, unsigned int k,
+      uint8_t live_neighbours)
+{
+    uint8_t *env = gs->env + 9 * k;
+
+    memcpy (env,     up   + x - 1, 3);
+    memcpy (env + 3, mid  + x - 1, 3);
+    memcpy (env + 6, down + x - 1, 3);
+    gs->live [k] = offset + x;
+    gs->live_neighbours [k] = live_neighbours;
+}
+
+static unsigned int
+gather_row_scalar (GameState *gs, const uint8_t *up, const uint8_t *mid,
+                   const uint8_t *down, unsigned int offset, unsigned int k)
+{
+    uint32_t bits;
+    int x, n, b;
+    uint8_t count;
+
+    for (x = 0; x < gs->width; x += 32) {
+        bits = occupied_bits (gs, offset + x, gs->width - x < 32 ? gs->width - x : 32);
+
+        while (bits) {
+            b = x + __builtin_ctz (bits);
+            count = 0;
+            for (n = -1; n <= 1; n++) {
+                count += (up [b + n] != 0) + (mid [b + n] != 0) + (down [b + n] != 0);
+            }
+            emit (gs, up, mid, down, b, offset, k++, count);
+            bits &= bits - 1;
+        }
+    }
+
+    return k;
+}
+
+#ifdef ENVIRONMENT_X86
+static unsigned int
+gather_row_sse2 (GameState *gs, const uint8_t *up, const uint8_t *mid,
+                 const uint8_t *down, unsigned int offset, unsigned int k)
+{
+    const __m128i zero = _mm_setzero_si128 ();
+    __m128i count;
+    uint8_t counts [16];
+    unsigned int bits;
+    int x, n, b;
+
+    for (x = 0; x < gs->width; x += 16) {
+        bits = occupied_bits (gs, offset + x, gs->width - x < 16 ? gs->width - x : 16);
+        // most of the field is empty most of the time
+        if (bits == 0) continue;
+
+        // start at 9 and subtract one for every empty slot
+        count = _mm_set1_epi8 (9);
+        for (n = -1; n <= 1; n++) {
+            count = _mm_add_epi8 (count, _mm_cmpeq_epi8 (zero,
+                        _mm_loadu_si128 ((const __m128i *) (up + x + n))));
+            count = _mm_add_epi8 (count, _mm_cmpeq_epi8 (zero,
+                        _mm_loadu_si128 ((const __m128i *) (mid + x + n))));
+            count = _mm_add_epi8 (count, _mm_cmpeq_epi8 (zero,
+                        _mm_loadu_si128 ((const __m128i *) (down + x + n))));
+        }
+        _mm_storeu_si128 ((__m128i *) counts, count);
+
+        while (bits) {
+            b = __builtin_ctz (bits);
+            emit (gs, up, mid, down, x + b, offset, k++, counts [b]);
+            bits &= bits - 1;
+        }
+    }
+
+    return k;
+}
+
+__attribute__ ((target ("avx2")))
+static unsigned int
+gather_row_avx2 (GameState *gs, const uint8_t *up, const uint8_t *mid,
+                 const uint8_t *down, unsigned int offset, unsigned int k)
+{
+    const __m256i zero = _mm256_setzero_si256 ();
+    __m256i count;
+    uint8_t counts [32];
+    uint32_t bits;
+    int x, n, b;
+
+    for (x = 0; x < gs->width; x += 32) {
+        bits = occupied_bits (gs, offset + x, gs->width - x < 32 ? gs->width - x : 32);
+        // most of the field is empty most of the time
+        if (bits == 0) continue;
+
+        // start at 9 and subtract one for every empty slot
+        count = _mm256_set1_epi8 (9);
+        for (n = -1; n <= 1; n++) {
+            count = _mm256_add_epi8 (count, _mm256_cmpeq_epi8 (zero,
+                        _mm256_loadu_si256 ((const __m256i *) (up + x + n))));
+            count = _mm256_add_epi8 (count, _mm256_cmpeq_epi8 (zero,
+                        _mm256_loadu_si256 ((const __m256i *) (mid + x + n))));
+            count = _mm256_add_epi8 (count, _mm256_cmpeq_epi8 (zero,
+                        _mm256_loadu_si256 ((const __m256i *) (down + x + n))));
+        }
+        _mm256_storeu_si256 ((__m256i *) counts, count);
+
+        while (bits) {
+            b = __builtin_ctz (bits);
+            emit (gs, up, mid, down, x + b, offset, k++, counts [b]);
+            bits &= bits - 1;
+        }
+    }
+
+    return k;
+}
+#endif
+
+/* Copies row y of the type plane into dst with one wrapped around cell on
+ * each side, returns dst + 1 */
+static inline uint8_t *
+pad_row (GameState *gs, uint8_t *dst, int y)
+{
+    const uint8_t *src = gs->type + y * gs->width;
+
+    dst [0] = src [gs->width - 1];
+    memcpy (dst + 1, src, gs->width);
+    dst [gs->width + 1] = src [0];
+
+    return dst + 1;
+}
+
+/* Three padded rows and which row of the field each of them holds */
+typedef struct {
+    uint8_t *buf [3];
+    int held [3];
+} RowCache;
+
+/* returns row y padded, copying it into a buffer that holds none of the rows
+ * keep and keep + 2 (modulo height) unless it is padded already */
+static inline uint8_t *
+cached_row (GameState *gs, RowCache *cache, int y, int keep)
+{
+    int i, h;
+
+    for (i = 0; i < 3; i++) {
+        if (cache->held [i] == y) return cache->buf [i] + 1;
+    }
+    for (i = 0; i < 3; i++) {
+        h = cache->held [i];
+        if (h != keep && h != (keep + 1) % gs->height && h != (keep + 2) % gs->height) {
+            break;
+        }
+    }
+    cache->held [i] = y;
+    return pad_row (gs, cache->buf [i], y);
+}
+
+unsigned int
+Environment_gather (GameState *gs)
+{
+    GatherRow gather_row = gather_row_scalar;
+    size_t stride = gs->width + 2 + ENVIRONMENT_OVERREAD;
+    RowCache cache = {
+        .buf  = {gs->rows, gs->rows + stride, gs->rows + 2 * stride},
+        .held = {-1, -1, -1}
+    };
+    uint8_t *up, *mid, *down;
+    unsigned int k = 0;
+    int y, above, below;
+
+#ifdef ENVIRONMENT_X86
+    if (__builtin_cpu_supports ("avx2")) {
+        gather_row = gather_row_avx2;
+    } else
+    if (__builtin_cpu_supports ("sse2")) {
+        gather_row = gather_row_sse2;
+    }
+#endif
+
+    // only rows with live cells and their neighbours are copied, each of them
+    // at most once as the three padded rows are reused while moving down
+    for (y = 0; y < gs->height; y++) {
+        if (!row_occupied (gs, y)) continue;
+
+        above = (y + gs->height - 1) % gs->height;
+        below = (y + 1) % gs->height;
+        up   = cached_row (gs, &cache, above, above);
+        mid  = cached_row (gs, &cache, y, above);
+        down = cached_row (gs, &cache, below, above);
+        k = gather_row (gs, up, mid, down, y * gs->width, k);
+    }
+
+    return k;
+}
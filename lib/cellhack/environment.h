@@ -0,0 +1,23 @@
+// Copyright 2015 Marvin Poul
+// Licensed under the Do What The Fuck You Want To License, Version 2
+// See LICENSE for details or http://www.wtfpl.net/txt/copying
+
+#ifndef ENVIRONMENT_H
+#define ENVIRONMENT_H
+
+#include "cellhack.h"
+
+// extra bytes after every padded row, so that vector loads may run past the
+// end of the row
+#define ENVIRONMENT_OVERREAD 32
+
+/* Collects all live cells of the field
+ * Rows and blocks without live cells are skipped by looking at gs->occupied,
+ * so the cost follows the number of live cells rather than the field size.
+ * For every live cell, in ascending order of their indices, its index goes to
+ * gs->live, its 3x3 environment to gs->env and its number of non-empty
+ * environment slots (itself included) to gs->live_neighbours. Uses AVX2 or
+ * SSE2 where the CPU has them and plain C otherwise.
+ * returns the number of live cells */
+unsigned int Environment_gather (GameState *gs);
+#endif
@@ -0,0 +1,48 @@
+// Copyright 2015 Marvin Poul
+// Licensed under the Do What The Fuck You Want To License, Version 2
+// See LICENSE for details or http://www.wtfpl.net/txt/copying
+
+#include <stdlib.h>
+
+#include "dbg.h"
+#include "framebuf.h"
+
+FrameBuffer *
+FrameBuffer_create (unsigned int cells)
+{
+    FrameBuffer *fb = NULL;
+    int i;
+
+    fb = calloc (1, sizeof (FrameBuffer));
+    check (fb != NULL, "Failed to alloc frame buffer.");
+    fb->back   = 0;
+    fb->middle = 1;
+    fb->front  = 2;
+
+    for (i = 0; i < 3; i++) {
+        fb->frames [i].types = calloc (cells, sizeof (uint8_t));
+        check (fb->frames [i].types != NULL, "Failed to alloc frame types.");
+        fb->frames [i].energies = calloc (cells, sizeof (uint8_t));
+        check (fb->frames [i].energies != NULL, "Failed to alloc frame energies.");
+    }
+
+    return fb;
+
+error:
+    FrameBuffer_destroy (fb);
+    return NULL;
+}
+
+void
+FrameBuffer_destroy (FrameBuffer *fb)
+{
+    int i;
+
+    if (!fb) return;
+
+    for (i = 0; i < 3; i++) {
+        if (fb->frames [i].types)    free (fb->frames [i].types);
+        if (fb->frames [i].energies) free (fb->frames [i].energies);
+    }
+    free (fb);
+}
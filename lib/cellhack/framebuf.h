@@ -0,0 +1,68 @@
+// Copyright 2015 Marvin Poul
+// Licensed under the Do What The Fuck You Want To License, Version 2
+// See LICENSE for details or http://www.wtfpl.net/txt/copying
+
+#ifndef FRAMEBUF_H
+#define FRAMEBUF_H
+
+#include <stdint.h>
+
+// set in FrameBuffer.middle while it holds a frame the reader has not taken
+#define FRAMEBUF_FRESH 4
+
+/* One turn's type and energy planes */
+typedef struct {
+    int turn;
+    uint8_t *types;
+    uint8_t *energies;
+} Frame;
+
+/* Hands frames from one writer to one reader without locks: the writer fills
+ * the back frame and swaps it with the middle one, the reader swaps the
+ * middle one with its front frame whenever it holds a newer one. Neither
+ * ever waits, the reader just skips the frames it was too slow for. */
+typedef struct {
+    Frame frames [3];
+    // owned by the writer
+    int back;
+    // index of the latest published frame, plus FRAMEBUF_FRESH until the
+    // reader took it; the only field both sides touch
+    int middle;
+    // owned by the reader
+    int front;
+} FrameBuffer;
+
+/* returns a buffer of frames of cells cells or NULL on error */
+FrameBuffer *FrameBuffer_create (unsigned int cells);
+
+/* Frees the buffer */
+void FrameBuffer_destroy (FrameBuffer *fb);
+
+/* returns the frame the writer may fill */
+#define FrameBuffer_back(fb) ((fb)->frames + (fb)->back)
+
+/* Makes the back frame the latest one, called by the writer once it filled
+ * it */
+static inline void
+FrameBuffer_publish (FrameBuffer *fb)
+{
+    int old = __atomic_exchange_n (&fb->middle, fb->back | FRAMEBUF_FRESH,
+                                   __ATOMIC_ACQ_REL);
+
+    fb->back = old & ~FRAMEBUF_FRESH;
+}
+
+/* returns the latest frame if it was published since the last call, NULL
+ * otherwise; called by the reader, the frame stays valid until the next call */
+static inline const Frame *
+FrameBuffer_acquire (FrameBuffer *fb)
+{
+    int old;
+
+    if (!(__atomic_load_n (&fb->middle, __ATOMIC_RELAXED) & FRAMEBUF_FRESH)) return NULL;
+
+    old = __atomic_exchange_n (&fb->middle, fb->front, __ATOMIC_ACQ_REL);
+    fb->front = old & ~FRAMEBUF_FRESH;
+    return fb->frames + fb->front;
+}
+#endif
@@ -0,0 +1,17 @@
+// Copyright 2015 Marvin Poul
+// Licensed under the Do What The Fuck You Want To License, Version 2
+// See LICENSE for details or http://www.wtfpl.net/txt/copying
+
+#include "json.h"
+
+void
+Json_put_string (FILE *out, const char *s)
+{
+    fputc ('"', out);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') fprintf (out, "\\%c", *s);
+        else if ((unsigned char) *s < 0x20) fprintf (out, "\\u%04x", *s);
+        else fputc (*s, out);
+    }
+    fputc ('"', out);
+}
@@ -0,0 +1,12 @@
+// Copyright 2015 Marvin Poul
+// Licensed under the Do What The Fuck You Want To License, Version 2
+// See LICENSE for details or http://www.wtfpl.net/txt/copying
+
+#ifndef JSON_H
+#define JSON_H
+
+#include <stdio.h>
+
+/* Writes s as JSON string, quotes included */
+void Json_put_string (FILE *out, const char *s);
+#endif
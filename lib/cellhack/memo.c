@@ -0,0 +1,188 @@
+// Copyright 2015 Marvin Poul
+// Licensed under the Do What The Fuck You Want To License, Version 2
+// See LICENSE for details or http://www.wtfpl.net/txt/copying
+
+#include <stdlib.h>
+
+#include "dbg.h"
+#include "memo.h"
+
+// set in MemoEntry.rest of entries that hold a decision
+#define MEMO_VALID (1ull << 24)
+
+Memo *
+Memo_create (unsigned int bits)
+{
+    Memo *memo = NULL;
+
+    memo = calloc (1, sizeof (Memo));
+    check (memo != NULL, "Failed to alloc decision cache.");
+
+    memo->mask = (1u << bits) - 1;
+    memo->entries = calloc (1u << bits, sizeof (MemoEntry));
+    check (memo->entries != NULL, "Failed to alloc decision cache entries.");
+
+    return memo;
+
+error:
+    Memo_destroy (memo);
+    return NULL;
+}
+
+void
+Memo_destroy (Memo *memo)
+{
+    if (!memo) return;
+
+    if (memo->entries) free (memo->entries);
+    free (memo);
+}
+
+/* Packs the arguments of a call into the key words of an entry */
+static inline void
+key (const uint8_t *env, uint8_t energy, uint64_t *words, uint64_t *rest)
+{
+    memcpy (words, env, sizeof (uint64_t));
+    *rest = env [8] | (uint64_t) energy << 8;
+}
+
+static inline MemoEntry *
+slot (Memo *memo, uint64_t env, uint64_t rest, uint64_t memory)
+{
+    uint64_t h = (env ^ rest * 0x9e3779b97f4a7c15ull) * 0xbf58476d1ce4e5b9ull;
+
+    h = (h ^ h >> 31 ^ memory) * 0x94d049bb133111ebull;
+    return memo->entries + ((h >> 32) & memo->mask);
+}
+
+/* returns 1 and the action and memory after the call if the cache holds the
+ * call, 0 otherwise */
+static inline int
+lookup (Memo *memo, const uint8_t *env, uint8_t energy, uint64_t memory,
+        uint8_t *action, uint64_t *result)
+{
+    uint64_t k_env, k_rest, seq, e_env, e_rest, e_memory, e_result;
+    MemoEntry *e;
+
+    key (env, energy, &k_env, &k_rest);
+    e = slot (memo, k_env, k_rest, memory);
+
+    seq = __atomic_load_n (&e->seq, __ATOMIC_ACQUIRE);
+    if (seq & 1) return 0;
+    e_env    = __atomic_load_n (&e->env, __ATOMIC_RELAXED);
+    e_rest   = __atomic_load_n (&e->rest, __ATOMIC_RELAXED);
+    e_memory = __atomic_load_n (&e->memory, __ATOMIC_RELAXED);
+    e_result = __atomic_load_n (&e->result, __ATOMIC_RELAXED);
+    __atomic_thread_fence (__ATOMIC_ACQUIRE);
+    if (__atomic_load_n (&e->seq, __ATOMIC_RELAXED) != seq) return 0;
+
+    if (!(e_rest & MEMO_VALID) || e_env != k_env || (e_rest & 0xffff) != k_rest
+        || e_memory != memory) return 0;
+
+    *action = e_rest >> 16;
+    *result = e_result;
+    return 1;
+}
+
+/* Stores a call's result, unless someone else is writing the same entry */
+static inline void
+insert (Memo *memo, const uint8_t *env, uint8_t energy, uint64_t memory,
+        uint8_t action, uint64_t result)
+{
+    uint64_t k_env, k_rest, seq;
+    MemoEntry *e;
+
+    key (env, energy, &k_env, &k_rest);
+    e = slot (memo, k_env, k_rest, memory);
+
+    seq = __atomic_load_n (&e->seq, __ATOMIC_RELAXED);
+    if (seq & 1) return;
+    if (!__atomic_compare_exchange_n (&e->seq, &seq, seq + 1, 0, __ATOMIC_RELAXED,
+                                      __ATOMIC_RELAXED)) return;
+    __atomic_thread_fence (__ATOMIC_RELEASE);
+
+    __atomic_store_n (&e->env, k_env, __ATOMIC_RELAXED);
+    __atomic_store_n (&e->rest, k_rest | (uint64_t) action << 16 | MEMO_VALID,
+                      __ATOMIC_RELAXED);
+    __atomic_store_n (&e->memory, memory, __ATOMIC_RELAXED);
+    __atomic_store_n (&e->result, result, __ATOMIC_RELAXED);
+
+    __atomic_store_n (&e->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+/* Calls the player on count cells, timing every call if hist is not NULL */
+static void
+call (CellHack_decide_action work, CellHack_decide_actions_batch batch,
+      unsigned int count, uint8_t *env, uint8_t *energy, uint64_t *memory,
+      uint8_t *action, ProfileHist *hist)
+{
+    uint64_t start = 0, end;
+    unsigned int k;
+
+    if (count == 0) return;
+    if (hist) start = Profile_now ();
+
+    if (batch) {
+        // cells the player leaves out do nothing
+        memset (action, 2, count);
+        batch (count, env, energy, memory, action);
+        if (!hist) return;
+
+        end = Profile_now ();
+        for (k = 0; k < count; k++) {
+            Profile_record (hist, (end - start) / count);
+        }
+    } else if (hist) {
+        for (k = 0; k < count; k++, start = end) {
+            action [k] = work (env + 9 * k, energy [k], memory + k);
+            end = Profile_now ();
+            Profile_record (hist, end - start);
+        }
+    } else {
+        for (k = 0; k < count; k++) {
+            action [k] = work (env + 9 * k, energy [k], memory + k);
+        }
+    }
+}
+
+void
+Memo_decide (Memo *memo, CellHack_decide_action work,
+             CellHack_decide_actions_batch batch, unsigned int count,
+             uint8_t *env, uint8_t *energy, uint64_t *memory, uint8_t *action,
+             ProfileHist *hist)
+{
+    // the cells that missed, players get copies so that what they do to
+    // their arguments does not end up in the keys
+    uint8_t miss_env [CELLHACK_CHUNK][9], miss_energy [CELLHACK_CHUNK];
+    uint8_t miss_action [CELLHACK_CHUNK];
+    uint64_t miss_memory [CELLHACK_CHUNK];
+    unsigned int miss [CELLHACK_CHUNK];
+    unsigned int k, m = 0;
+
+    if (!memo) {
+        call (work, batch, count, env, energy, memory, action, hist);
+        return;
+    }
+
+    for (k = 0; k < count; k++) {
+        if (lookup (memo, env + 9 * k, energy [k], memory [k], action + k, memory + k)) {
+            continue;
+        }
+        memcpy (miss_env [m], env + 9 * k, 9);
+        miss_energy [m] = energy [k];
+        miss_memory [m] = memory [k];
+        miss [m++] = k;
+    }
+
+    call (work, batch, m, miss_env [0], miss_energy, miss_memory, miss_action, hist);
+
+    for (k = 0; k < m; k++) {
+        insert (memo, env + 9 * miss [k], energy [miss [k]], memory [miss [k]],
+                miss_action [k], miss_memory [k]);
+        action [miss [k]] = miss_action [k];
+        memory [miss [k]] = miss_memory [k];
+    }
+
+    __atomic_add_fetch (&memo->hits, count - m, __ATOMIC_RELAXED);
+    __atomic_add_fetch (&memo->misses, m, __ATOMIC_RELAXED);
+}
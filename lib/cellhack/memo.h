@@ -0,0 +1,61 @@
+// Copyright 2015 Marvin Poul
+// Licensed under the Do What The Fuck You Want To License, Version 2
+// See LICENSE for details or http://www.wtfpl.net/txt/copying
+
+#ifndef MEMO_H
+#define MEMO_H
+
+#include <stdint.h>
+
+#include "cellhack.h"
+#include "profile.h"
+
+// log2 of the number of entries of every player's cache
+#define MEMO_BITS 16
+
+/* One cached decision, guarded by a sequence lock: seq is odd while the entry
+ * is being written and bumped once more when done, readers that see it odd
+ * or changed treat the entry as a miss */
+typedef struct {
+    uint64_t seq;
+    // env bytes 0 to 7
+    uint64_t env;
+    // env byte 8, energy, returned action and a bit that is set once the
+    // entry holds a decision
+    uint64_t rest;
+    uint64_t memory;
+    // memory after the call
+    uint64_t result;
+} MemoEntry;
+
+/* Direct mapped cache of the decisions of one pure player, shared by all
+ * executors deciding on the player's cells */
+typedef struct Memo {
+    unsigned int mask;
+    MemoEntry *entries;
+    // lookups that were answered from and that missed the cache
+    uint64_t hits;
+    uint64_t misses;
+} Memo;
+
+#define Memo_hits(memo) __atomic_load_n (&(memo)->hits, __ATOMIC_RELAXED)
+#define Memo_misses(memo) __atomic_load_n (&(memo)->misses, __ATOMIC_RELAXED)
+
+/* returns a cache of 1 << bits entries or NULL on error */
+Memo *Memo_create (unsigned int bits);
+
+/* Frees the cache */
+void Memo_destroy (Memo *memo);
+
+/* Decides on count (at most CELLHACK_CHUNK) cells, cell k's environment is
+ * env [9 * k] … env [9 * k + 8], its energy energy [k], memory memory [k] and
+ * its action is stored to action [k].
+ * Cells found in memo (which may be NULL) are answered from it, the others
+ * are handed to batch if not NULL or to work one by one and their results
+ * added to memo. If hist is not NULL, the time of every call of the player
+ * is recorded in it. */
+void Memo_decide (Memo *memo, CellHack_decide_action work,
+                  CellHack_decide_actions_batch batch, unsigned int count,
+                  uint8_t *env, uint8_t *energy, uint64_t *memory, uint8_t *action,
+                  ProfileHist *hist);
+#endif
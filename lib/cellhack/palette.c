@@ -0,0 +1,60 @@
+// Copyright 2015 Marvin Poul
+// Licensed under the Do What The Fuck You Want To License, Version 2
+// See LICENSE for details or http://www.wtfpl.net/txt/copying
+
+#include <stdlib.h>
+
+#include "dbg.h"
+#include "palette.h"
+
+Palette *
+Palette_create (int num)
+{
+    Palette *palette = NULL;
+    unsigned int hue, sector, rise, fall;
+    // saturation 0.8 and value 0.85 keep every colour dark enough to stand
+    // out from the white background
+    unsigned int v = 217, low = 43;
+    uint8_t *rgb;
+    int n;
+
+    palette = calloc (1, sizeof (Palette));
+    check (palette != NULL, "Failed to alloc palette.");
+    palette->num = num;
+    palette->rgb = calloc (3 * num, sizeof (uint8_t));
+    check (palette->rgb != NULL, "Failed to alloc player colours.");
+
+    for (n = 0; n < num; n++) {
+        // steps of the golden ratio through the hues, in 1/1536 of a turn,
+        // so that players next to each other get far apart colours
+        hue = (n * 949u) % 1536;
+        sector = hue / 256;
+        rise = low + (v - low) * (hue % 256) / 256;
+        fall = v - (v - low) * (hue % 256) / 256;
+        rgb = palette->rgb + 3 * n;
+
+        switch (sector) {
+            case 0:  rgb [0] = v;    rgb [1] = rise; rgb [2] = low;  break;
+            case 1:  rgb [0] = fall; rgb [1] = v;    rgb [2] = low;  break;
+            case 2:  rgb [0] = low;  rgb [1] = v;    rgb [2] = rise; break;
+            case 3:  rgb [0] = low;  rgb [1] = fall; rgb [2] = v;    break;
+            case 4:  rgb [0] = rise; rgb [1] = low;  rgb [2] = v;    break;
+            default: rgb [0] = v;    rgb [1] = low;  rgb [2] = fall; break;
+        }
+    }
+
+    return palette;
+
+error:
+    Palette_destroy (palette);
+    return NULL;
+}
+
+void
+Palette_destroy (Palette *palette)
+{
+    if (!palette) return;
+
+    if (palette->rgb) free (palette->rgb);
+    free (palette);
+}
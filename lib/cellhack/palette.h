@@ -0,0 +1,54 @@
+// Copyright 2015 Marvin Poul
+// Licensed under the Do What The Fuck You Want To License, Version 2
+// See LICENSE for details or http://www.wtfpl.net/txt/copying
+
+#ifndef PALETTE_H
+#define PALETTE_H
+
+#include <stdint.h>
+
+// background the cells are drawn on and colour of rocks
+#define PALETTE_BACKGROUND 255
+#define PALETTE_ROCK 64
+
+/* Colours of the players of a game, shared by everything that draws cells so
+ * that a player looks the same in the game window and in rendered replays */
+typedef struct {
+    int num;
+    // rgb [3 * n] … rgb [3 * n + 2] is the colour of player n, i.e. of cells
+    // of type n + 1
+    uint8_t *rgb;
+} Palette;
+
+/* returns colours for num players, which are the same every time and spread
+ * evenly over the hues, or NULL on error */
+Palette *Palette_create (int num);
+
+/* Frees the palette */
+void Palette_destroy (Palette *palette);
+
+/* Stores the colour of a cell to rgb: its player's colour drawn with energy
+ * + 55 as alpha (opaque from 200 energy on) over the background, or the
+ * background for empty cells and unknown players */
+static inline void
+Palette_shade (const Palette *palette, uint8_t type, uint8_t energy, uint8_t *rgb)
+{
+    const uint8_t *color;
+    unsigned int alpha = energy > 200 ? 255 : energy + 55;
+    int c;
+
+    if (type == 255) {
+        rgb [0] = rgb [1] = rgb [2] = PALETTE_ROCK;
+        return;
+    }
+    if (type == 0 || type > palette->num) {
+        rgb [0] = rgb [1] = rgb [2] = PALETTE_BACKGROUND;
+        return;
+    }
+
+    color = palette->rgb + 3 * (type - 1);
+    for (c = 0; c < 3; c++) {
+        rgb [c] = (color [c] * alpha + PALETTE_BACKGROUND * (255 - alpha) + 127) / 255;
+    }
+}
+#endif
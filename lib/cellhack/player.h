@@ -30,6 +30,40 @@
 
 uint8_t cell_decide_action(uint8_t *env, uint8_t energy, uint64_t *memory);
 
+// Optionally, a player may implement the following function as well:
+
+// void cell_decide_actions_batch(unsigned int count, uint8_t *env,
+//                                uint8_t *energy, uint64_t *memory,
+//                                uint8_t *action)
+//
+// Called instead of cell_decide_action with up to 256 of your cells at once,
+// so that setup can be shared and lookups vectorized.
+//
+// env    - count environments of 9 bytes each, cell k's is env[9*k] to
+//          env[9*k+8], laid out as above.
+// energy - count energy levels.
+// memory - count memories, changes are kept just like with
+//          cell_decide_action.
+// action - count actions to fill in; the ones left alone are NOTHING.
+//
+// Each call gets only cells of your own. cell_decide_action must still be
+// there, it is used where the batch function is not.
+
+void cell_decide_actions_batch(unsigned int count, uint8_t *env,
+                               uint8_t *energy, uint64_t *memory,
+                               uint8_t *action);
+
+// If your decisions depend on nothing but env, energy and memory (no random
+// numbers, no state of your own), say so with
+//
+// const int cell_pure = 1;
+//
+// and the engine remembers what you decided for which arguments and answers
+// repeated questions without calling you. Don't lie, the cached decision and
+// memory are used as they are.
+
+extern const int cell_pure;
+
 
 // named constants for environment offsets
 #define LEFT_UP    0
@@ -0,0 +1,462 @@
+// Copyright 2015 Marvin Poul
+// Licensed under the Do What The Fuck You Want To License, Version 2
+// See LICENSE for details or http://www.wtfpl.net/txt/copying
+
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pool.h"
+
+#define range_lo(r) ((unsigned int) ((r) & 0xffffffff))
+#define range_hi(r) ((unsigned int) ((r) >> 32))
+#define range_pack(lo, hi) ((uint64_t) (lo) | ((uint64_t) (hi) << 32))
+
+// bounds for the watchdog interval
+#define WATCHDOG_MIN_INTERVAL   100000
+#define WATCHDOG_MAX_INTERVAL 10000000
+
+static inline uint64_t
+clock_ns (clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime (clock, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Takes the next chunk from the executor's own range or, if that is empty,
+ * steals the last chunk of somebody else's.
+ * returns 1 if a chunk was found, 0 if all chunks are taken */
+static int
+take_chunk (ExecutorWorker *self, unsigned int *chunk)
+{
+    ExecutorPool *pool = self->pool;
+    ExecutorWorker *victim;
+    uint64_t range;
+    int i;
+
+    range = __atomic_load_n (&self->range, __ATOMIC_ACQUIRE);
+    while (range_lo (range) < range_hi (range)) {
+        if (__atomic_compare_exchange_n (&self->range, &range, range + 1, 0,
+                                         __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            *chunk = range_lo (range);
+            return 1;
+        }
+    }
+
+    // cancelled executors' leftovers are stolen as well
+    for (i = 1; i < pool->size; i++) {
+        victim = pool->workers + (self->id + i) % pool->size;
+        range = __atomic_load_n (&victim->range, __ATOMIC_ACQUIRE);
+        while (range_lo (range) < range_hi (range)) {
+            if (__atomic_compare_exchange_n (&victim->range, &range,
+                                             range - ((uint64_t) 1 << 32), 0,
+                                             __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                *chunk = range_hi (range) - 1;
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+static void *
+Executor (ExecutorWorker *self)
+{
+    ExecutorPool *pool;
+    ExecutorBudget *budget;
+    ExecutorTask task;
+    void *arg;
+    unsigned int chunk;
+    uint8_t account;
+    uint64_t spent;
+    int err = 0, busy;
+    check (self != NULL, "Got NULL as args.");
+    pool = self->pool;
+    err = pthread_setcanceltype (PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
+    check (err == 0, "Failed to set cancel type to asynchronous.");
+    err = pthread_getcpuclockid (pthread_self (), &self->clock);
+    check (err == 0, "Failed to get thread CPU clock.");
+
+    while (1) {
+
+        pthread_mutex_lock (&pool->lock);
+        while ((self->state != EXECUTOR_ACTIVE
+                    || pool->generation == self->generation)
+                && !pool->shutdown) {
+            pthread_cond_wait (&pool->start, &pool->lock);
+        }
+        if (pool->shutdown) {
+            pthread_mutex_unlock (&pool->lock);
+            break;
+        }
+        self->generation = pool->generation;
+        task   = pool->task;
+        arg    = pool->arg;
+        budget = pool->budget;
+        pthread_mutex_unlock (&pool->lock);
+
+        // no lock may be held while running the task, otherwise the pool
+        // cannot cancel us if it unexpectedly blocks
+        while (take_chunk (self, &chunk)) {
+            self->chunk = chunk;
+            if (budget) {
+                account = budget->chunk_account [chunk];
+                if (__atomic_load_n (budget->exceeded + account, __ATOMIC_RELAXED)) {
+                    continue;
+                }
+                self->chunk_cpu  = clock_ns (CLOCK_THREAD_CPUTIME_ID);
+                self->chunk_wall = clock_ns (CLOCK_MONOTONIC);
+            }
+            __atomic_store_n (&self->busy, 1, __ATOMIC_RELEASE);
+
+            task (arg, chunk, self->id);
+
+            busy = 1;
+            if (!__atomic_compare_exchange_n (&self->busy, &busy, 0, 0,
+                                              __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                // too late, the watchdog is already cancelling us
+                while (1) pause ();
+            }
+
+            if (budget) {
+                spent = clock_ns (CLOCK_THREAD_CPUTIME_ID) - self->chunk_cpu;
+                spent = __atomic_add_fetch (budget->spent + account, spent,
+                                            __ATOMIC_RELAXED);
+                if (budget->cpu_limit && spent > budget->cpu_limit) {
+                    __atomic_store_n (budget->exceeded + account, 1, __ATOMIC_RELAXED);
+                }
+            }
+        }
+
+        pthread_mutex_lock (&pool->lock);
+        if (--pool->active == 0) {
+            pthread_cond_signal (&pool->finished);
+        }
+        pthread_mutex_unlock (&pool->lock);
+    }
+
+error:
+    return NULL;
+}
+
+/* Starts a thread for the given executor in the given state
+ * Must be called with the pool lock held */
+static int
+spawn (ExecutorPool *pool, ExecutorWorker *worker, int state)
+{
+    int err;
+
+    worker->busy  = 0;
+    worker->state = state;
+    // an active executor spawned in the middle of a run joins right in
+    worker->generation = pool->generation - 1;
+    err = pthread_create (&worker->tid, NULL,
+                          (void *(*)(void *)) Executor, worker);
+    check (err == 0, "Failed to create executor thread.");
+
+    return 0;
+
+error:
+    worker->state = EXECUTOR_DEAD;
+    return 1;
+}
+
+/* Cancels an executor that is running over its budget and puts a standby
+ * executor in its place
+ * returns 0 on success, 1 if nobody took its place, the run is marked failed
+ * then and no longer waits for it
+ * Must be called with the pool lock held */
+static int
+replace (ExecutorPool *pool, ExecutorWorker *worker)
+{
+    int busy = 1, i;
+
+    if (!__atomic_compare_exchange_n (&worker->busy, &busy, 2, 0,
+                                      __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        // finished its chunk in the meantime
+        return 0;
+    }
+
+    pthread_cancel (worker->tid);
+    worker->state = EXECUTOR_DEAD;
+
+    for (i = 0; i < pool->size; i++) {
+        if (pool->workers [i].state == EXECUTOR_STANDBY) {
+            pool->workers [i].state = EXECUTOR_ACTIVE;
+            pool->workers [i].generation = pool->generation - 1;
+            pthread_cond_broadcast (&pool->start);
+            return 0;
+        }
+    }
+
+    // ran out of standby executors, there is no way around waiting for a
+    // new thread then
+    pthread_join (worker->tid, NULL);
+    if (spawn (pool, worker, EXECUTOR_ACTIVE) == 0) return 0;
+
+    // the live executors steal what is left of its chunks, but its share of
+    // the run is never finished
+    pool->failed = 1;
+    if (--pool->active == 0) {
+        pthread_cond_signal (&pool->finished);
+    }
+    return 1;
+}
+
+/* Looks at all busy executors, charges the CPU time of the chunks they are
+ * running to their accounts and replaces those over budget
+ * Must be called with the pool lock held */
+static int
+inspect (ExecutorPool *pool)
+{
+    ExecutorBudget *budget = pool->budget;
+    ExecutorWorker *worker;
+    uint64_t running [256] = {0}, now, wall = clock_ns (CLOCK_MONOTONIC);
+    uint8_t account;
+    int err = 0, i;
+
+    for (i = 0; i < pool->size; i++) {
+        worker = pool->workers + i;
+        if (worker->state != EXECUTOR_ACTIVE) continue;
+        if (__atomic_load_n (&worker->busy, __ATOMIC_ACQUIRE) != 1) continue;
+
+        account = budget->chunk_account [worker->chunk];
+        now = clock_ns (worker->clock);
+        if (now > worker->chunk_cpu) running [account] += now - worker->chunk_cpu;
+        if (budget->wall_limit && wall - worker->chunk_wall > budget->wall_limit) {
+            __atomic_store_n (budget->exceeded + account, 1, __ATOMIC_RELAXED);
+        }
+    }
+
+    for (i = 0; i < budget->accounts && budget->cpu_limit; i++) {
+        if (__atomic_load_n (budget->spent + i, __ATOMIC_RELAXED) + running [i]
+                > budget->cpu_limit) {
+            __atomic_store_n (budget->exceeded + i, 1, __ATOMIC_RELAXED);
+        }
+    }
+
+    for (i = 0; i < pool->size; i++) {
+        worker = pool->workers + i;
+        if (worker->state != EXECUTOR_ACTIVE) continue;
+        if (__atomic_load_n (&worker->busy, __ATOMIC_ACQUIRE) != 1) continue;
+
+        account = budget->chunk_account [worker->chunk];
+        if (!__atomic_load_n (budget->exceeded + account, __ATOMIC_RELAXED)) continue;
+
+        // the others over budget still have to go
+        if (replace (pool, worker)) {
+            log_err ("Failed to replace executor.");
+            err = 1;
+        }
+    }
+
+    return err;
+}
+
+/* Respawns cancelled executors as standby
+ * Must be called with the pool lock held */
+static int
+respawn (ExecutorPool *pool)
+{
+    int err, i;
+
+    for (i = 0; i < pool->size; i++) {
+        if (pool->workers [i].state != EXECUTOR_DEAD) continue;
+
+        pthread_join (pool->workers [i].tid, NULL);
+        err = spawn (pool, pool->workers + i, EXECUTOR_STANDBY);
+        check (err == 0, "Failed to respawn executor.");
+    }
+
+    return 0;
+
+error:
+    return 1;
+}
+
+static void *
+Watchdog (ExecutorPool *pool)
+{
+    struct timespec ts;
+
+    pthread_mutex_lock (&pool->lock);
+    while (!pool->shutdown) {
+        // executors that failed to respawn stay dead and are tried again on
+        // the next look, runs only go on without spares meanwhile
+        if (respawn (pool)) log_info ("Running short of standby executors.");
+
+        if (pool->active == 0 || pool->budget == NULL) {
+            pthread_cond_wait (&pool->watch, &pool->lock);
+            continue;
+        }
+
+        // the next run may change the interval as soon as the lock is gone
+        ts.tv_sec  = pool->interval / 1000000000;
+        ts.tv_nsec = pool->interval % 1000000000;
+        pthread_mutex_unlock (&pool->lock);
+
+        clock_nanosleep (CLOCK_MONOTONIC, 0, &ts, NULL);
+
+        pthread_mutex_lock (&pool->lock);
+        if (pool->active > 0 && pool->budget && inspect (pool)) pool->failed = 1;
+    }
+    pthread_mutex_unlock (&pool->lock);
+
+    return NULL;
+}
+
+ExecutorPool *
+ExecutorPool_create (int threads, int standby)
+{
+    ExecutorPool *pool = NULL;
+    int err = 0, i;
+    check (threads > 0, "Need at least one executor.");
+    check (standby >= 0, "Need a non-negative number of standby executors.");
+
+    pool = calloc (1, sizeof (ExecutorPool));
+    check (pool != NULL, "Failed to alloc executor pool.");
+
+    err = posix_memalign ((void **) &pool->workers, 64,
+                          (threads + standby) * sizeof (ExecutorWorker));
+    check (err == 0, "Failed to alloc executors.");
+    memset (pool->workers, 0, (threads + standby) * sizeof (ExecutorWorker));
+
+    err = pthread_mutex_init (&pool->lock, NULL);
+    check (err == 0, "Failed to init mutex.");
+
+    err = pthread_cond_init (&pool->finished, NULL);
+    check (err == 0, "Failed to init condition.");
+
+    err = pthread_cond_init (&pool->start, NULL);
+    check (err == 0, "Failed to init condition.");
+
+    err = pthread_cond_init (&pool->watch, NULL);
+    check (err == 0, "Failed to init condition.");
+
+    pool->threads = threads;
+    pool->standby = standby;
+
+    pthread_mutex_lock (&pool->lock);
+    for (i = 0; i < threads + standby; i++, pool->size++) {
+        pool->workers [i].id   = i;
+        pool->workers [i].pool = pool;
+        err = spawn (pool, pool->workers + i,
+                     i < threads ? EXECUTOR_ACTIVE : EXECUTOR_STANDBY);
+        if (err != 0) break;
+        // executors only start working on the next generation
+        pool->workers [i].generation = pool->generation;
+    }
+    pthread_mutex_unlock (&pool->lock);
+    check (err == 0, "Failed to create executor thread.");
+
+    err = pthread_create (&pool->watchdog, NULL,
+                          (void *(*)(void *)) Watchdog, pool);
+    check (err == 0, "Failed to create watchdog thread.");
+    pool->watchdog_running = 1;
+
+    return pool;
+
+error:
+    ExecutorPool_destroy (pool);
+    return NULL;
+}
+
+void
+ExecutorPool_destroy (ExecutorPool *pool)
+{
+    int i;
+    if (!pool) return;
+
+    if (pool->workers) {
+        pthread_mutex_lock (&pool->lock);
+        pool->shutdown = 1;
+        pthread_cond_broadcast (&pool->start);
+        pthread_cond_signal (&pool->watch);
+        pthread_mutex_unlock (&pool->lock);
+
+        if (pool->watchdog_running) pthread_join (pool->watchdog, NULL);
+        for (i = 0; i < pool->size; i++) {
+            pthread_join (pool->workers [i].tid, NULL);
+        }
+        free (pool->workers);
+    }
+
+    pthread_cond_destroy (&pool->watch);
+    pthread_cond_destroy (&pool->start);
+    pthread_cond_destroy (&pool->finished);
+    pthread_mutex_destroy (&pool->lock);
+    free (pool);
+}
+
+int
+ExecutorPool_run (ExecutorPool *pool, unsigned int chunks, ExecutorTask task,
+                  void *arg, ExecutorBudget *budget)
+{
+    uint64_t lo, hi;
+    int err = 0, i, k, active;
+    check (pool != NULL, "Got NULL as pool.");
+
+    if (budget) {
+        memset (budget->spent, 0, budget->accounts * sizeof (uint64_t));
+        memset (budget->exceeded, 0, budget->accounts * sizeof (uint8_t));
+    }
+
+    if (chunks == 0) return 0;
+
+    pthread_mutex_lock (&pool->lock);
+
+    pool->task   = task;
+    pool->arg    = arg;
+    pool->budget = budget;
+    pool->failed = 0;
+    // a cancelled executor that could not be replaced leaves a gap, which
+    // standby executors fill once the watchdog managed to respawn some
+    for (i = 0, active = 0; i < pool->size; i++) {
+        if (pool->workers [i].state == EXECUTOR_ACTIVE) active++;
+    }
+    for (i = 0; i < pool->size && active < pool->threads; i++) {
+        if (pool->workers [i].state != EXECUTOR_STANDBY) continue;
+        pool->workers [i].state = EXECUTOR_ACTIVE;
+        active++;
+    }
+    check (active > 0, "No executor left to run on.");
+    for (i = 0, k = 0; i < pool->size; i++) {
+        if (pool->workers [i].state == EXECUTOR_ACTIVE) {
+            lo = (uint64_t) chunks * k / active;
+            hi = (uint64_t) chunks * (k + 1) / active;
+            k++;
+        } else {
+            lo = hi = 0;
+        }
+        __atomic_store_n (&pool->workers [i].range, range_pack (lo, hi),
+                          __ATOMIC_RELAXED);
+    }
+    pool->active = active;
+    pool->generation++;
+    pthread_cond_broadcast (&pool->start);
+
+    if (budget) {
+        pool->interval = budget->cpu_limit / 4;
+        if (pool->interval < WATCHDOG_MIN_INTERVAL) pool->interval = WATCHDOG_MIN_INTERVAL;
+        if (pool->interval > WATCHDOG_MAX_INTERVAL) pool->interval = WATCHDOG_MAX_INTERVAL;
+        pthread_cond_signal (&pool->watch);
+    }
+
+    while (pool->active > 0) {
+        err = pthread_cond_wait (&pool->finished, &pool->lock);
+        check (err == 0, "Error while waiting on condition.");
+    }
+
+    pool->budget = NULL;
+    // let the watchdog respawn whatever it had to cancel
+    pthread_cond_signal (&pool->watch);
+    check (!pool->failed, "Lost an executor that could not be replaced.");
+    pthread_mutex_unlock (&pool->lock);
+    return 0;
+
+error:
+    if (pool) pthread_mutex_unlock (&pool->lock);
+    return 1;
+}
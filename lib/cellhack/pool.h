@@ -0,0 +1,115 @@
+// Copyright 2015 Marvin Poul
+// Licensed under the Do What The Fuck You Want To License, Version 2
+// See LICENSE for details or http://www.wtfpl.net/txt/copying
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "dbg.h"
+
+/* Work function run by the pool for every chunk
+ * arg      as given to ExecutorPool_run
+ * chunk    index of the chunk to process, from 0 to number of chunks exclusive
+ * worker   index of the executor running it
+ */
+typedef void (*ExecutorTask) (void *arg, unsigned int chunk, int worker);
+
+/* Limits on how long the chunks of one account (e.g. a player) may run
+ * Every chunk is charged to an account, accounts that go over their limit are
+ * flagged in exceeded, their executors are cancelled and their remaining
+ * chunks are skipped. Tasks should stop early once their account is flagged.
+ */
+typedef struct {
+    // nanoseconds of executor CPU time every account may use in one run,
+    // 0 for no limit
+    uint64_t cpu_limit;
+    // nanoseconds of wall time a single chunk may take, catches executors
+    // that block without using any CPU time, 0 for no limit
+    uint64_t wall_limit;
+    int accounts;
+    // account charged for every chunk
+    const uint8_t *chunk_account;
+    // CPU time used by every account in the current run, in nanoseconds
+    uint64_t *spent;
+    // set for accounts that went over their limit
+    uint8_t *exceeded;
+} ExecutorBudget;
+
+#define EXECUTOR_STANDBY 0
+#define EXECUTOR_ACTIVE  1
+#define EXECUTOR_DEAD    2
+
+struct ExecutorPool;
+
+typedef struct {
+    // chunks still owned by this executor, lower 32 bits are the next chunk
+    // the owner takes, upper 32 bits one past the last chunk, which thieves
+    // take from the top
+    uint64_t range;
+    // 1 while running a chunk, 2 if the pool is about to cancel it, 0 otherwise
+    int busy;
+    // one of EXECUTOR_*
+    int state;
+    unsigned int chunk;
+    // thread CPU time and monotonic time when the current chunk started
+    uint64_t chunk_cpu;
+    uint64_t chunk_wall;
+    clockid_t clock;
+    unsigned long generation;
+    pthread_t tid;
+    int id;
+    struct ExecutorPool *pool;
+} __attribute__ ((aligned (64))) ExecutorWorker;
+
+typedef struct ExecutorPool {
+    // number of active executors
+    int threads;
+    // number of executors kept around to replace cancelled ones
+    int standby;
+    // threads + standby
+    int size;
+    ExecutorWorker *workers;
+    pthread_mutex_t lock;
+    // signaled when there is a new generation of work
+    pthread_cond_t start;
+    // signaled when the last executor ran out of work
+    pthread_cond_t finished;
+    // signaled when a run with a budget starts
+    pthread_cond_t watch;
+    pthread_t watchdog;
+    int watchdog_running;
+    // nanoseconds between two looks of the watchdog at the executors
+    uint64_t interval;
+    unsigned long generation;
+    // executors still working on the current generation
+    int active;
+    // set by the watchdog if it failed to keep the current run going, the
+    // run then ends with an error instead of waiting for lost executors
+    int failed;
+    int shutdown;
+    ExecutorTask task;
+    ExecutorBudget *budget;
+    void *arg;
+} ExecutorPool;
+
+/* Starts threads active and standby spare executors plus the watchdog */
+ExecutorPool *ExecutorPool_create (int threads, int standby);
+
+/* Stops all executors and frees the pool */
+void ExecutorPool_destroy (ExecutorPool *pool);
+
+/* Runs task on the chunks 0 … chunks - 1 spread over all executors and waits
+ * until all of them are done.
+ * Every executor starts with a contiguous share of the chunks and steals from
+ * the others once it ran out. If budget is not NULL, the watchdog cancels
+ * executors whose account went over the budget and promotes a standby
+ * executor in their place; the cancelled threads are respawned as standby
+ * executors by the watchdog, not on the caller's time.
+ * returns 0 on success, 1 on error */
+int ExecutorPool_run (ExecutorPool *pool, unsigned int chunks, ExecutorTask task,
+                      void *arg, ExecutorBudget *budget);
+#endif
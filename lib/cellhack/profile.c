@@ -0,0 +1,62 @@
+// Copyright 2015 Marvin Poul
+// Licensed under the Do What The Fuck You Want To License, Version 2
+// See LICENSE for details or http://www.wtfpl.net/txt/copying
+
+#include <stdlib.h>
+
+#include "dbg.h"
+#include "profile.h"
+
+const char *Profile_phase_names [PROFILE_PHASES] = {
+    "gather", "decide", "apply", "resolve"
+};
+
+Profile *
+Profile_create (int players, int workers)
+{
+    Profile *p = NULL;
+
+    p = calloc (1, sizeof (Profile));
+    check (p != NULL, "Failed to alloc profile.");
+    p->players = players;
+    p->workers = workers;
+
+    // calloc of 0 bytes may well return NULL
+    if (workers > 0) {
+        p->decisions = calloc (players * workers, sizeof (ProfileHist));
+        check (p->decisions != NULL, "Failed to alloc decision histograms.");
+    }
+
+    p->timeouts = calloc (players, sizeof (uint64_t));
+    check (p->timeouts != NULL, "Failed to alloc timeout counters.");
+
+    return p;
+
+error:
+    Profile_destroy (p);
+    return NULL;
+}
+
+void
+Profile_destroy (Profile *p)
+{
+    if (!p) return;
+
+    if (p->decisions) free (p->decisions);
+    if (p->timeouts)  free (p->timeouts);
+    free (p);
+}
+
+void
+Profile_merge (ProfileHist *dst, const ProfileHist *src)
+{
+    uint64_t max = __atomic_load_n (&src->max, __ATOMIC_RELAXED);
+    int b;
+
+    dst->count += __atomic_load_n (&src->count, __ATOMIC_RELAXED);
+    dst->total += __atomic_load_n (&src->total, __ATOMIC_RELAXED);
+    if (max > dst->max) dst->max = max;
+    for (b = 0; b < PROFILE_BUCKETS; b++) {
+        dst->hist [b] += __atomic_load_n (src->hist + b, __ATOMIC_RELAXED);
+    }
+}
@@ -0,0 +1,82 @@
+// Copyright 2015 Marvin Poul
+// Licensed under the Do What The Fuck You Want To License, Version 2
+// See LICENSE for details or http://www.wtfpl.net/txt/copying
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+#include <time.h>
+
+// phases of a tick
+#define PROFILE_GATHER  0
+#define PROFILE_DECIDE  1
+#define PROFILE_APPLY   2
+#define PROFILE_RESOLVE 3
+#define PROFILE_PHASES  4
+
+// bucket b counts samples of 2^b to 2^(b+1) - 1 nanoseconds, the last one
+// everything longer
+#define PROFILE_BUCKETS 32
+
+/* Samples of one kind of duration, in nanoseconds
+ * Every histogram has a single writer, readers may look at it at any time and
+ * see it a few samples behind. */
+typedef struct {
+    uint64_t count;
+    uint64_t total;
+    uint64_t max;
+    uint64_t hist [PROFILE_BUCKETS];
+} ProfileHist;
+
+/* Where the time of a game goes */
+typedef struct {
+    int players;
+    // number of executors deciding on cells, each records into a slice of
+    // decisions of its own
+    int workers;
+    // wall time of each phase per tick
+    ProfileHist phases [PROFILE_PHASES];
+    // time of every call of a player, decisions [w * players + n] holds the
+    // calls of player n made by executor w; calls of the batch entry point
+    // are recorded once per cell with the call's time split between them;
+    // NULL without executors
+    ProfileHist *decisions;
+    // turns every player ran out of time
+    uint64_t *timeouts;
+} Profile;
+
+extern const char *Profile_phase_names [PROFILE_PHASES];
+
+/* returns a profile for players players decided on by workers executors, 0
+ * if they decide elsewhere (e.g. in worker processes), or NULL on error */
+Profile *Profile_create (int players, int workers);
+
+/* Frees the profile */
+void Profile_destroy (Profile *p);
+
+/* Adds the samples of src to dst */
+void Profile_merge (ProfileHist *dst, const ProfileHist *src);
+
+/* returns the monotonic time in nanoseconds */
+static inline uint64_t
+Profile_now (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Adds a sample of ns nanoseconds to h, only ever called by h's writer */
+static inline void
+Profile_record (ProfileHist *h, uint64_t ns)
+{
+    int b = ns ? 63 - __builtin_clzll (ns) : 0;
+
+    if (b >= PROFILE_BUCKETS) b = PROFILE_BUCKETS - 1;
+    __atomic_store_n (&h->count, h->count + 1, __ATOMIC_RELAXED);
+    __atomic_store_n (&h->total, h->total + ns, __ATOMIC_RELAXED);
+    if (ns > h->max) __atomic_store_n (&h->max, ns, __ATOMIC_RELAXED);
+    __atomic_store_n (h->hist + b, h->hist [b] + 1, __ATOMIC_RELAXED);
+}
+#endif
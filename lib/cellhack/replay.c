@@ -0,0 +1,455 @@
+// Copyright 2015 Marvin Poul
+// Licensed under the Do What The Fuck You Want To License, Version 2
+// See LICENSE for details or http://www.wtfpl.net/txt/copying
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "dbg.h"
+#include "replay.h"
+
+// fixed part of the version 2 header and of every frame, see save.h
+#define REPLAY_HEADER_SIZE 40
+#define REPLAY_FRAME_HEADER_SIZE 9
+
+static inline uint32_t
+get_u32 (const uint8_t *src)
+{
+    return src [0] | src [1] << 8 | src [2] << 16 | (uint32_t) src [3] << 24;
+}
+
+static inline uint64_t
+get_u64 (const uint8_t *src)
+{
+    return get_u32 (src) | (uint64_t) get_u32 (src + 4) << 32;
+}
+
+/* Splits the text header into its values, names point into replay->meta
+ * returns 0 on success, 1 on error */
+static int
+parse_meta (Replay *replay)
+{
+    char *line, *value, *end, *players = NULL;
+    int n;
+
+    for (line = replay->meta; line && *line; line = end) {
+        end = strchr (line, '\n');
+        if (end) *end++ = '\0';
+
+        value = strchr (line, ':');
+        if (!value) continue;
+        *value++ = '\0';
+        while (*value == ' ') value++;
+
+        if (strcmp (line, "width") == 0)   replay->width  = atoi (value);
+        if (strcmp (line, "height") == 0)  replay->height = atoi (value);
+        if (strcmp (line, "players") == 0) players = value;
+    }
+    check (players != NULL, "Replay lacks the players.");
+    check (replay->width > 0 && replay->height > 0, "Replay lacks the size of the field.");
+
+    for (n = 1, value = players; (value = strchr (value, ',')); value++) n++;
+    check (replay->num == 0 || replay->num == n, "Replay disagrees with itself on the players.");
+    replay->num = n;
+
+    replay->names = calloc (n, sizeof (char *));
+    check (replay->names != NULL, "Failed to alloc player names.");
+    for (n = 0, value = players; value; n++) {
+        replay->names [n] = value;
+        value = strchr (value, ',');
+        if (value) {
+            *value++ = '\0';
+            while (*value == ' ') value++;
+        }
+    }
+
+    return 0;
+
+error:
+    return 1;
+}
+
+/* Adds a keyframe to the index
+ * returns 0 on success, 1 on error */
+static int
+add_key (Replay *replay, unsigned int *size, uint32_t frame, uint64_t offset)
+{
+    uint32_t *frames;
+    uint64_t *offsets;
+    unsigned int grown;
+
+    if (replay->keys == *size) {
+        grown = *size ? 2 * *size : 64;
+        frames = realloc (replay->key_frames, grown * sizeof (uint32_t));
+        check (frames != NULL, "Failed to grow keyframe index.");
+        replay->key_frames = frames;
+        offsets = realloc (replay->key_offsets, grown * sizeof (uint64_t));
+        check (offsets != NULL, "Failed to grow keyframe index.");
+        replay->key_offsets = offsets;
+        *size = grown;
+    }
+    replay->key_frames [replay->keys]  = frame;
+    replay->key_offsets [replay->keys] = offset;
+    replay->keys++;
+
+    return 0;
+
+error:
+    return 1;
+}
+
+/* Reads the keyframe index of a version 2 replay or, if it has none, walks
+ * all frames to find them
+ * returns 0 on success, 1 on error */
+static int
+read_index (Replay *replay)
+{
+    const uint8_t *footer, *entry;
+    uint64_t index, offset;
+    unsigned int i, count, size = 0;
+    int err;
+
+    footer = replay->map + replay->size - SAVE_FOOTER_SIZE;
+    if (replay->size >= replay->start + SAVE_FOOTER_SIZE
+        && memcmp (footer + 12, SAVE_FOOTER_MAGIC, 4) == 0) {
+        index = get_u64 (footer);
+        replay->frames = get_u32 (footer + 8);
+        check (index >= replay->start && index + 4 <= replay->size - SAVE_FOOTER_SIZE,
+               "Replay index out of bounds.");
+
+        count = get_u32 (replay->map + index);
+        check ((replay->size - SAVE_FOOTER_SIZE - index - 4) / 12 >= count,
+               "Replay index out of bounds.");
+        for (i = 0; i < count; i++) {
+            entry = replay->map + index + 4 + 12 * i;
+            check (get_u64 (entry + 4) + REPLAY_FRAME_HEADER_SIZE <= index,
+                   "Keyframe out of bounds.");
+            err = add_key (replay, &size, get_u32 (entry), get_u64 (entry + 4));
+            check (err == 0, "Failed to read keyframe index.");
+        }
+    } else {
+        log_info ("Replay has no index, looking for keyframes.");
+        for (offset = replay->start;
+             offset + REPLAY_FRAME_HEADER_SIZE <= replay->size;
+             offset += REPLAY_FRAME_HEADER_SIZE + get_u32 (replay->map + offset + 5)) {
+            if (offset + REPLAY_FRAME_HEADER_SIZE
+                    + get_u32 (replay->map + offset + 5) > replay->size) break;
+
+            if (replay->map [offset] == SAVE_KEYFRAME) {
+                err = add_key (replay, &size, replay->frames, offset);
+                check (err == 0, "Failed to build keyframe index.");
+            }
+            replay->frames++;
+        }
+    }
+
+    check (replay->frames == 0 || (replay->keys > 0 && replay->key_frames [0] == 0),
+           "Replay does not start with a keyframe.");
+    return 0;
+
+error:
+    return 1;
+}
+
+Replay *
+Replay_open (const char *path)
+{
+    Replay *replay = NULL;
+    struct stat st;
+    const uint8_t *end;
+    size_t meta_size;
+    int fd = -1, err;
+
+    replay = calloc (1, sizeof (Replay));
+    check (replay != NULL, "Failed to alloc replay.");
+    replay->map = MAP_FAILED;
+
+    fd = open (path, O_RDONLY);
+    check (fd >= 0, "Failed to open replay %s.", path);
+    err = fstat (fd, &st);
+    check (err == 0 && st.st_size > 0, "Failed to get size of replay %s.", path);
+
+    replay->size = st.st_size;
+    replay->map  = mmap (NULL, replay->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    check (replay->map != MAP_FAILED, "Failed to map replay %s.", path);
+    close (fd);
+    fd = -1;
+
+    if (replay->size >= REPLAY_HEADER_SIZE && memcmp (replay->map, SAVE_MAGIC, 8) == 0) {
+        replay->version = get_u32 (replay->map + 8);
+        check (replay->version == 2, "Unknown replay version %i.", replay->version);
+        replay->start  = get_u32 (replay->map + 12);
+        replay->width  = get_u32 (replay->map + 16);
+        replay->height = get_u32 (replay->map + 20);
+        replay->num    = get_u32 (replay->map + 24);
+        replay->fields = get_u32 (replay->map + 28);
+        meta_size      = get_u32 (replay->map + 36);
+        check (replay->start == REPLAY_HEADER_SIZE + meta_size
+               && replay->start <= replay->size, "Replay header out of bounds.");
+        check (replay->fields != 0 && (replay->fields & ~SAVE_ALL) == 0,
+               "Replay records unknown fields.");
+
+        replay->meta = strndup ((const char *) replay->map + REPLAY_HEADER_SIZE, meta_size);
+    } else {
+        replay->version = 1;
+        replay->fields  = SAVE_ALL;
+        end = memchr (replay->map, '\0', replay->size);
+        check (end != NULL, "Replay header never ends.");
+        replay->start = end - replay->map + 1;
+
+        replay->meta = strndup ((const char *) replay->map, replay->start);
+    }
+    check (replay->meta != NULL, "Failed to copy replay header.");
+
+    err = parse_meta (replay);
+    check (err == 0, "Failed to read replay header.");
+
+    if (replay->version == 1) {
+        replay->frames = (replay->size - replay->start)
+                         / ((size_t) replay->width * replay->height * sizeof (SaveFormat));
+    } else {
+        err = read_index (replay);
+        check (err == 0, "Failed to index replay.");
+    }
+
+    return replay;
+
+error:
+    if (fd >= 0) close (fd);
+    Replay_close (replay);
+    return NULL;
+}
+
+void
+Replay_close (Replay *replay)
+{
+    if (!replay) return;
+
+    if (replay->map != MAP_FAILED && replay->map) {
+        munmap ((void *) replay->map, replay->size);
+    }
+    if (replay->meta)  free (replay->meta);
+    if (replay->names) free (replay->names);
+    if (replay->key_frames)  free (replay->key_frames);
+    if (replay->key_offsets) free (replay->key_offsets);
+    free (replay);
+}
+
+ReplayFrame *
+ReplayFrame_create (const Replay *replay)
+{
+    ReplayFrame *frame = NULL;
+    size_t cells;
+    check (replay != NULL, "Got NULL as replay.");
+    cells = (size_t) replay->width * replay->height;
+
+    frame = calloc (1, sizeof (ReplayFrame));
+    check (frame != NULL, "Failed to alloc replay frame.");
+    frame->replay = replay;
+    frame->frame  = -1;
+
+    if (replay->version == 1) {
+        frame->stride = frame->memory_stride = sizeof (SaveFormat);
+        return frame;
+    }
+
+    frame->stride = 1;
+    frame->memory_stride = sizeof (uint64_t);
+    if (replay->fields & SAVE_TYPE) {
+        frame->type_buf = calloc (cells, sizeof (uint8_t));
+        check (frame->type_buf != NULL, "Failed to alloc type plane.");
+        frame->raw_size += cells;
+    }
+    if (replay->fields & SAVE_ENERGY) {
+        frame->energy_buf = calloc (cells, sizeof (uint8_t));
+        check (frame->energy_buf != NULL, "Failed to alloc energy plane.");
+        frame->raw_size += cells;
+    }
+    if (replay->fields & SAVE_MEMORY) {
+        frame->memory_buf = calloc (cells, sizeof (uint64_t));
+        check (frame->memory_buf != NULL, "Failed to alloc memory plane.");
+        frame->raw_size += 8 * cells;
+    }
+    // no payload is bigger than a keyframe
+    frame->raw = malloc (frame->raw_size);
+    check (frame->raw != NULL, "Failed to alloc frame payload.");
+
+    return frame;
+
+error:
+    ReplayFrame_destroy (frame);
+    return NULL;
+}
+
+void
+ReplayFrame_destroy (ReplayFrame *frame)
+{
+    if (!frame) return;
+
+    if (frame->type_buf)   free (frame->type_buf);
+    if (frame->energy_buf) free (frame->energy_buf);
+    if (frame->memory_buf) free (frame->memory_buf);
+    if (frame->raw)        free (frame->raw);
+    free (frame);
+}
+
+/* Unpacks the version 2 frame at offset into frame->raw and applies it to
+ * the planes
+ * returns 0 on success, 1 on error */
+static int
+apply (ReplayFrame *frame, uint64_t offset)
+{
+    const Replay *replay = frame->replay;
+    size_t cells = (size_t) replay->width * replay->height;
+    size_t raw_size, packed_size, size, pos = 0, n;
+    uint64_t count, gap, i, idx = (uint64_t) -1;
+    uint8_t kind;
+    int b;
+
+    check (offset + REPLAY_FRAME_HEADER_SIZE <= replay->size, "Frame out of bounds.");
+    kind        = replay->map [offset];
+    raw_size    = get_u32 (replay->map + offset + 1);
+    packed_size = get_u32 (replay->map + offset + 5);
+    check (packed_size <= replay->size - offset - REPLAY_FRAME_HEADER_SIZE,
+           "Frame out of bounds.");
+
+    size = Save_unpack (frame->raw, frame->raw_size,
+                        replay->map + offset + REPLAY_FRAME_HEADER_SIZE, packed_size);
+    check (size == raw_size, "Corrupt frame at offset %llu.", (unsigned long long) offset);
+    frame->next = offset + REPLAY_FRAME_HEADER_SIZE + packed_size;
+
+    if (kind == SAVE_KEYFRAME) {
+        check (size == frame->raw_size, "Keyframe has the wrong size.");
+        if (frame->type_buf) {
+            memcpy (frame->type_buf, frame->raw + pos, cells);
+            pos += cells;
+        }
+        if (frame->energy_buf) {
+            memcpy (frame->energy_buf, frame->raw + pos, cells);
+            pos += cells;
+        }
+        if (frame->memory_buf) {
+            memset (frame->memory_buf, 0, cells * sizeof (uint64_t));
+            for (b = 0; b < 8; b++, pos += cells) {
+                for (i = 0; i < cells; i++) {
+                    frame->memory_buf [i] |= (uint64_t) frame->raw [pos + i] << (8 * b);
+                }
+            }
+        }
+        return 0;
+    }
+    check (kind == SAVE_DELTA, "Unknown kind of frame %i.", kind);
+
+    n = Save_get_varint (frame->raw, size, &count);
+    check (n > 0, "Corrupt delta.");
+    for (pos = n; count > 0; count--) {
+        n = Save_get_varint (frame->raw + pos, size - pos, &gap);
+        check (n > 0, "Corrupt delta.");
+        pos += n;
+        idx += gap;
+        check (idx < cells, "Delta out of bounds.");
+
+        if (frame->type_buf) {
+            check (pos < size, "Corrupt delta.");
+            frame->type_buf [idx] = frame->raw [pos++];
+        }
+        if (frame->energy_buf) {
+            check (pos < size, "Corrupt delta.");
+            frame->energy_buf [idx] = frame->raw [pos++];
+        }
+        if (frame->memory_buf) {
+            n = Save_get_varint (frame->raw + pos, size - pos, frame->memory_buf + idx);
+            check (n > 0, "Corrupt delta.");
+            pos += n;
+        }
+    }
+
+    return 0;
+
+error:
+    return 1;
+}
+
+int
+Replay_frame (ReplayFrame *frame, unsigned int n)
+{
+    const Replay *replay;
+    const uint8_t *cells;
+    unsigned int lo, hi, mid;
+    int err;
+    check (frame != NULL, "Got NULL as frame.");
+    replay = frame->replay;
+    check (n < replay->frames, "Replay has no frame %u.", n);
+
+    if (replay->version == 1) {
+        cells = replay->map + replay->start
+                + (size_t) n * replay->width * replay->height * sizeof (SaveFormat);
+        frame->types    = cells + offsetof (SaveFormat, player);
+        frame->energies = cells + offsetof (SaveFormat, energy);
+        frame->memories = cells + offsetof (SaveFormat, memory);
+        frame->frame    = n;
+        return 0;
+    }
+
+    // last keyframe at or before n
+    for (lo = 0, hi = replay->keys; hi - lo > 1;) {
+        mid = (lo + hi) / 2;
+        if (replay->key_frames [mid] <= n) lo = mid;
+        else hi = mid;
+    }
+
+    // going forward from the frame held is never slower than starting over
+    // from the keyframe
+    if (frame->frame < 0 || frame->frame > n || frame->frame < replay->key_frames [lo]) {
+        frame->frame = -1;
+        err = apply (frame, replay->key_offsets [lo]);
+        check (err == 0, "Failed to read keyframe %u.", replay->key_frames [lo]);
+        frame->frame = replay->key_frames [lo];
+    }
+    while (frame->frame < n) {
+        err = apply (frame, frame->next);
+        frame->frame = err ? -1 : frame->frame + 1;
+        check (err == 0, "Failed to read frame %u.", n);
+    }
+
+    frame->types    = frame->type_buf;
+    frame->energies = frame->energy_buf;
+    frame->memories = (const uint8_t *) frame->memory_buf;
+    return 0;
+
+error:
+    return 1;
+}
+
+void
+ReplayFrame_planes (const ReplayFrame *frame, uint8_t *types, uint8_t *energies,
+                    uint64_t *memories)
+{
+    unsigned int i, cells = frame->replay->width * frame->replay->height;
+
+    // decoded planes are contiguous already
+    if (frame->stride == 1) {
+        if (types) {
+            if (frame->types) memcpy (types, frame->types, cells);
+            else memset (types, 0, cells);
+        }
+        if (energies) {
+            if (frame->energies) memcpy (energies, frame->energies, cells);
+            else memset (energies, 0, cells);
+        }
+        if (memories) {
+            if (frame->memories) memcpy (memories, frame->memories, cells * sizeof (uint64_t));
+            else memset (memories, 0, cells * sizeof (uint64_t));
+        }
+        return;
+    }
+
+    for (i = 0; i < cells; i++) {
+        if (types)    types [i]    = ReplayFrame_type (frame, i);
+        if (energies) energies [i] = ReplayFrame_energy (frame, i);
+        if (memories) memories [i] = ReplayFrame_memory (frame, i);
+    }
+}
@@ -0,0 +1,118 @@
+// Copyright 2015 Marvin Poul
+// Licensed under the Do What The Fuck You Want To License, Version 2
+// See LICENSE for details or http://www.wtfpl.net/txt/copying
+
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "save.h"
+
+/* A replay file mapped into memory, see save.h for the formats
+ * Nothing in it changes after Replay_open, so any number of threads may read
+ * frames from it at once, each with its own ReplayFrame. */
+typedef struct {
+    // the fields up to names are read by bin/cellhack_replay.py, keep their
+    // order
+    int version;
+    int width;
+    int height;
+    // number of players, names [n] belongs to cell type n + 1
+    int num;
+    // SAVE_* flags of the recorded planes
+    int fields;
+    unsigned int frames;
+    char **names;
+    // the whole file
+    const uint8_t *map;
+    size_t size;
+    // copy of the text header, names point into it
+    char *meta;
+    // offset of the first frame
+    size_t start;
+    // frame and file offset of every keyframe, version 2 only
+    uint32_t *key_frames;
+    uint64_t *key_offsets;
+    unsigned int keys;
+} Replay;
+
+/* The cells of one frame, cell idx of the frame is at types [idx * stride],
+ * energies [idx * stride] and memories + idx * memory_stride (eight unaligned
+ * bytes in host order), all of which are NULL for planes that are not
+ * recorded.
+ * Frames of version 1 replays point right into the mapped file, those of
+ * version 2 into buffers of their own that are decoded from the closest
+ * keyframe, or just from the current frame when moving forward. */
+typedef struct {
+    const Replay *replay;
+    // frame held right now, -1 for none
+    long frame;
+    size_t stride;
+    size_t memory_stride;
+    const uint8_t *types;
+    const uint8_t *energies;
+    const uint8_t *memories;
+    // decoded planes and the payload of the frame being decoded, version 2
+    // only
+    uint8_t *type_buf;
+    uint8_t *energy_buf;
+    uint64_t *memory_buf;
+    uint8_t *raw;
+    size_t raw_size;
+    // file offset of the frame after the one held
+    uint64_t next;
+} ReplayFrame;
+
+/* Maps the replay at path and reads its header and keyframe index
+ * Version 2 replays without index (e.g. from a crashed game) are scanned for
+ * their keyframes instead.
+ * returns NULL on error */
+Replay *Replay_open (const char *path);
+
+/* Unmaps the replay, all its frames must be destroyed first */
+void Replay_close (Replay *replay);
+
+/* returns a new frame object for replay or NULL on error, it holds no frame
+ * until Replay_frame is called on it */
+ReplayFrame *ReplayFrame_create (const Replay *replay);
+
+/* Frees the frame */
+void ReplayFrame_destroy (ReplayFrame *frame);
+
+/* Loads frame n of the replay into frame
+ * returns 0 on success, 1 on error */
+int Replay_frame (ReplayFrame *frame, unsigned int n);
+
+/* Copies the planes of frame into types, energies and memories, each of which
+ * may be NULL if not wanted; planes that are not recorded are zeroed */
+void ReplayFrame_planes (const ReplayFrame *frame, uint8_t *types,
+                         uint8_t *energies, uint64_t *memories);
+
+#define Replay_width(r) ((r)->width)
+#define Replay_height(r) ((r)->height)
+#define Replay_frames(r) ((r)->frames)
+
+static inline uint8_t
+ReplayFrame_type (const ReplayFrame *f, unsigned int idx)
+{
+    return f->types ? f->types [idx * f->stride] : 0;
+}
+
+static inline uint8_t
+ReplayFrame_energy (const ReplayFrame *f, unsigned int idx)
+{
+    return f->energies ? f->energies [idx * f->stride] : 0;
+}
+
+static inline uint64_t
+ReplayFrame_memory (const ReplayFrame *f, unsigned int idx)
+{
+    uint64_t memory = 0;
+
+    if (f->memories) memcpy (&memory, f->memories + idx * f->memory_stride, sizeof (uint64_t));
+    return memory;
+}
+#endif
@@ -0,0 +1,19 @@
+// Copyright 2015 Marvin Poul
+// Licensed under the Do What The Fuck You Want To License, Version 2
+// See LICENSE for details or http://www.wtfpl.net/txt/copying
+
+#include "rng.h"
+
+void
+Rng_seed (Rng *rng, uint64_t seed)
+{
+    uint64_t z;
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        z = (seed += 0x9e3779b97f4a7c15ull);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        rng->s [i] = z ^ (z >> 31);
+    }
+}
@@ -0,0 +1,62 @@
+// Copyright 2015 Marvin Poul
+// Licensed under the Do What The Fuck You Want To License, Version 2
+// See LICENSE for details or http://www.wtfpl.net/txt/copying
+
+#ifndef RNG_H
+#define RNG_H
+
+#include <stdint.h>
+
+/* xoshiro256** generator, every game has its own so that games don't share
+ * state with each other or with the players' use of rand () */
+typedef struct {
+    uint64_t s [4];
+} Rng;
+
+/* Expands seed into the full generator state with splitmix64, the same seed
+ * always gives the same sequence */
+void Rng_seed (Rng *rng, uint64_t seed);
+
+static inline uint64_t
+Rng_rotl (uint64_t x, int k)
+{
+    return (x << k) | (x >> (64 - k));
+}
+
+/* returns the next 64 random bits */
+static inline uint64_t
+Rng_next (Rng *rng)
+{
+    uint64_t *s = rng->s;
+    uint64_t result = Rng_rotl (s [1] * 5, 7) * 9;
+    uint64_t t = s [1] << 17;
+
+    s [2] ^= s [0];
+    s [3] ^= s [1];
+    s [1] ^= s [2];
+    s [0] ^= s [3];
+    s [2] ^= t;
+    s [3] = Rng_rotl (s [3], 45);
+
+    return result;
+}
+
+/* returns an integer from 0 to max exclusive without modulo bias, max must
+ * not be 0 (Lemire's multiply and reject) */
+static inline uint32_t
+Rng_below (Rng *rng, uint32_t max)
+{
+    uint64_t m = (Rng_next (rng) >> 32) * max;
+    uint32_t low = (uint32_t) m, threshold;
+
+    if (low < max) {
+        threshold = -max % max;
+        while (low < threshold) {
+            m = (Rng_next (rng) >> 32) * max;
+            low = (uint32_t) m;
+        }
+    }
+
+    return m >> 32;
+}
+#endif
@@ -0,0 +1,364 @@
+// Copyright 2015 Marvin Poul
+// Licensed under the Do What The Fuck You Want To License, Version 2
+// See LICENSE for details or http://www.wtfpl.net/txt/copying
+
+#include <limits.h>
+#include <linux/futex.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "memo.h"
+#include "sandbox.h"
+
+// bounds for how long the engine sleeps before looking for dead or runaway
+// workers
+#define SANDBOX_MIN_INTERVAL   100000
+#define SANDBOX_MAX_INTERVAL 10000000
+
+static inline int
+futex_wait (uint32_t *addr, uint32_t val, const struct timespec *timeout)
+{
+    return syscall (SYS_futex, addr, FUTEX_WAIT, val, timeout, NULL, 0);
+}
+
+static inline int
+futex_wake (uint32_t *addr)
+{
+    return syscall (SYS_futex, addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+static inline uint64_t
+clock_ns (clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime (clock, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Main loop of a worker process, never returns */
+static void
+Worker (SandboxShared *shared, SandboxRing *ring, CellHack_decide_action work,
+        CellHack_decide_actions_batch batch, int pure)
+{
+    SandboxSlot *slot;
+    uint32_t done = 0;
+    uint64_t hits = 0, misses = 0;
+    // the worker just runs uncached if there is no room for the cache
+    Memo *memo = pure ? Memo_create (MEMO_BITS) : NULL;
+
+    while (1) {
+        if (__atomic_load_n (&ring->head, __ATOMIC_ACQUIRE) == done) {
+            __atomic_store_n (&ring->waiting, 1, __ATOMIC_SEQ_CST);
+            if (__atomic_load_n (&ring->head, __ATOMIC_SEQ_CST) == done) {
+                futex_wait (&ring->head, done, NULL);
+            }
+            __atomic_store_n (&ring->waiting, 0, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        slot = ring->slots + done % SANDBOX_SLOTS;
+        Memo_decide (memo, work, batch, slot->count, slot->env [0], slot->energy,
+                     slot->memory, slot->action,
+                     __atomic_load_n (&ring->profile, __ATOMIC_RELAXED) ? &ring->decisions : NULL);
+        if (memo) {
+            __atomic_add_fetch (&ring->hits, Memo_hits (memo) - hits, __ATOMIC_RELAXED);
+            __atomic_add_fetch (&ring->misses, Memo_misses (memo) - misses, __ATOMIC_RELAXED);
+            hits   = Memo_hits (memo);
+            misses = Memo_misses (memo);
+        }
+
+        __atomic_store_n (&ring->done, ++done, __ATOMIC_SEQ_CST);
+        __atomic_add_fetch (&shared->bell, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n (&shared->waiting, __ATOMIC_SEQ_CST)) {
+            futex_wake (&shared->bell);
+        }
+    }
+}
+
+/* Forks the worker of player n with an empty ring
+ */
+static int
+spawn (Sandbox *sb, int n)
+{
+    SandboxRing *ring = sb->rings [n];
+    pid_t parent = getpid ();
+    int m;
+
+    ring->head    = 0;
+    ring->done    = 0;
+    ring->waiting = 0;
+    sb->heads [n] = 0;
+
+    sb->pids [n] = fork ();
+    check (sb->pids [n] >= 0, "Failed to fork worker process.");
+
+    if (sb->pids [n] == 0) {
+        // don't outlive the engine
+        prctl (PR_SET_PDEATHSIG, SIGKILL);
+        if (getppid () != parent) _exit (1);
+
+        // all the worker gets to see of the game are its own cells
+        for (m = 0; m < sb->num; m++) {
+            if (m != n && sb->rings [m]) munmap (sb->rings [m], sizeof (SandboxRing));
+        }
+
+        Worker (sb->shared, ring, sb->ai [n], sb->batch_ai [n], sb->pure [n]);
+        _exit (0);
+    }
+
+    return 0;
+
+error:
+    sb->pids [n] = 0;
+    return 1;
+}
+
+/* Kills the worker of player n and forks a fresh one
+ */
+static int
+restart (Sandbox *sb, int n)
+{
+    if (sb->pids [n] > 0) {
+        kill (sb->pids [n], SIGKILL);
+        waitpid (sb->pids [n], NULL, 0);
+    }
+
+    return spawn (sb, n);
+}
+
+Sandbox *
+Sandbox_create (int num, CellHack_decide_action *ai,
+                CellHack_decide_actions_batch *batch_ai, const int *pure)
+{
+    Sandbox *sb = NULL;
+    int err, n;
+    check (num > 0, "Need at least one player.");
+
+    sb = calloc (1, sizeof (Sandbox));
+    check (sb != NULL, "Failed to alloc sandbox.");
+
+    sb->pids = calloc (num, sizeof (pid_t));
+    check (sb->pids != NULL, "Failed to alloc worker pids.");
+
+    sb->pure = calloc (num, sizeof (uint8_t));
+    check (sb->pure != NULL, "Failed to alloc purity flags.");
+    for (n = 0; n < num && pure; n++) {
+        sb->pure [n] = pure [n] != 0;
+    }
+
+    sb->heads = calloc (num, sizeof (uint32_t));
+    check (sb->heads != NULL, "Failed to alloc ring heads.");
+
+    sb->counts = calloc (num * SANDBOX_SLOTS, sizeof (uint32_t));
+    check (sb->counts != NULL, "Failed to alloc slot counts.");
+
+    sb->ai = ai;
+    sb->batch_ai = batch_ai;
+    sb->shared = mmap (NULL, sizeof (SandboxShared), PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    check (sb->shared != MAP_FAILED, "Failed to map shared memory for workers.");
+
+    sb->rings = calloc (num, sizeof (SandboxRing *));
+    check (sb->rings != NULL, "Failed to alloc rings.");
+    sb->num = num;
+    // all rings exist before the first fork, so every worker can unmap the
+    // others' rings
+    for (n = 0; n < num; n++) {
+        sb->rings [n] = mmap (NULL, sizeof (SandboxRing), PROT_READ | PROT_WRITE,
+                              MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (sb->rings [n] == MAP_FAILED) sb->rings [n] = NULL;
+        check (sb->rings [n] != NULL, "Failed to map ring of player %i.", n);
+    }
+
+    for (n = 0; n < num; n++) {
+        err = spawn (sb, n);
+        check (err == 0, "Failed to start worker of player %i.", n);
+    }
+
+    return sb;
+
+error:
+    if (sb && sb->shared == MAP_FAILED) sb->shared = NULL;
+    Sandbox_destroy (sb);
+    return NULL;
+}
+
+void
+Sandbox_destroy (Sandbox *sb)
+{
+    int n;
+    if (!sb) return;
+
+    for (n = 0; n < sb->num; n++) {
+        if (sb->pids [n] <= 0) continue;
+        kill (sb->pids [n], SIGKILL);
+        waitpid (sb->pids [n], NULL, 0);
+    }
+
+    for (n = 0; sb->rings && n < sb->num; n++) {
+        if (sb->rings [n]) munmap (sb->rings [n], sizeof (SandboxRing));
+    }
+    if (sb->rings) free (sb->rings);
+    if (sb->shared) munmap (sb->shared, sizeof (SandboxShared));
+    if (sb->pids) free (sb->pids);
+    if (sb->pure) free (sb->pure);
+    if (sb->heads) free (sb->heads);
+    if (sb->counts) free (sb->counts);
+    free (sb);
+}
+
+int
+Sandbox_run (Sandbox *sb, GameState *gs, ExecutorBudget *budget)
+{
+    SandboxRing *ring;
+    SandboxSlot *slot;
+    struct timespec ts;
+    int n, err, remaining = 0, pushed;
+    unsigned int k, pos, idx, end, count;
+    uint32_t bell, head, done, *counts;
+    uint64_t now, interval = SANDBOX_MAX_INTERVAL;
+    // next cell to ship and next cell to collect of every player
+    unsigned int next [gs->num], collect [gs->num];
+    // slots collected of every player
+    uint32_t collected [gs->num];
+    uint8_t active [gs->num];
+    clockid_t clocks [gs->num];
+    uint64_t cpu [gs->num], progress [gs->num];
+    check (sb != NULL, "Got NULL as sandbox.");
+
+    if (budget) {
+        memset (budget->spent, 0, budget->accounts * sizeof (uint64_t));
+        memset (budget->exceeded, 0, budget->accounts * sizeof (uint8_t));
+
+        interval = budget->cpu_limit / 4;
+        if (interval < SANDBOX_MIN_INTERVAL) interval = SANDBOX_MIN_INTERVAL;
+        if (interval > SANDBOX_MAX_INTERVAL) interval = SANDBOX_MAX_INTERVAL;
+    }
+    ts.tv_sec  = interval / 1000000000;
+    ts.tv_nsec = interval % 1000000000;
+
+    for (n = 0; n < gs->num; n++) {
+        next [n] = collect [n] = gs->batch_start [n];
+        // every slot pushed in earlier turns was collected or dropped with
+        // its worker
+        collected [n] = sb->heads [n];
+        active [n] = gs->batch_start [n] < gs->batch_start [n + 1];
+        if (!active [n]) continue;
+
+        // a failed restart in an earlier turn left the player without worker
+        if (sb->pids [n] <= 0 && spawn (sb, n) != 0) {
+            active [n] = 0;
+            continue;
+        }
+
+        remaining++;
+        progress [n] = clock_ns (CLOCK_MONOTONIC);
+        if (budget) {
+            err = clock_getcpuclockid (sb->pids [n], clocks + n);
+            check (err == 0, "Failed to get CPU clock of player %s.", gs->names [n]);
+            cpu [n] = clock_ns (clocks [n]);
+        }
+    }
+
+    while (remaining > 0) {
+        bell = __atomic_load_n (&sb->shared->bell, __ATOMIC_SEQ_CST);
+
+        for (n = 0; n < gs->num; n++) {
+            if (!active [n]) continue;
+            ring = sb->rings [n];
+            end  = gs->batch_start [n + 1];
+
+            counts = sb->counts + n * SANDBOX_SLOTS;
+
+            // done comes from the worker, a worker that claims to have
+            // finished slots it was never given is as good as crashed
+            done = __atomic_load_n (&ring->done, __ATOMIC_ACQUIRE);
+            if (done - collected [n] > sb->heads [n] - collected [n]) {
+                log_info ("Player %s corrupted its ring.", gs->names [n]);
+                err = restart (sb, n);
+                check (err == 0, "Failed to restart worker of player %s.", gs->names [n]);
+                active [n] = 0;
+                remaining--;
+                continue;
+            }
+            for (; collected [n] != done; collected [n]++) {
+                slot  = ring->slots + collected [n] % SANDBOX_SLOTS;
+                count = counts [collected [n] % SANDBOX_SLOTS];
+                for (k = 0; k < count; k++) {
+                    pos = gs->work [collect [n] + k];
+                    gs->actions [pos] = slot->action [k];
+                    gs->memory [gs->live [pos]] = slot->memory [k];
+                }
+                collect [n] += count;
+                progress [n] = clock_ns (CLOCK_MONOTONIC);
+            }
+
+            head = sb->heads [n];
+            pushed = 0;
+            while (next [n] < end && head - collected [n] < SANDBOX_SLOTS) {
+                slot  = ring->slots + head % SANDBOX_SLOTS;
+                count = end - next [n] < CELLHACK_CHUNK ? end - next [n] : CELLHACK_CHUNK;
+                for (k = 0; k < count; k++) {
+                    pos = gs->work [next [n] + k];
+                    idx = gs->live [pos];
+                    memcpy (slot->env [k], gs->env + 9 * pos, 9);
+                    slot->energy [k] = gs->energy [idx];
+                    slot->memory [k] = gs->memory [idx];
+                }
+                slot->count = counts [head % SANDBOX_SLOTS] = count;
+                next [n] += count;
+                sb->heads [n] = ++head;
+                __atomic_store_n (&ring->head, head, __ATOMIC_SEQ_CST);
+                pushed = 1;
+            }
+            if (pushed && __atomic_load_n (&ring->waiting, __ATOMIC_SEQ_CST)) {
+                futex_wake (&ring->head);
+            }
+
+            if (collect [n] >= end) {
+                active [n] = 0;
+                remaining--;
+            }
+        }
+        if (remaining == 0) break;
+
+        // look for workers that died or ran out of time, their remaining
+        // cells just keep doing nothing
+        now = clock_ns (CLOCK_MONOTONIC);
+        for (n = 0; n < gs->num; n++) {
+            if (!active [n]) continue;
+
+            if (waitpid (sb->pids [n], NULL, WNOHANG) == sb->pids [n]) {
+                log_info ("Player %s crashed.", gs->names [n]);
+                sb->pids [n] = 0;
+            } else
+            if (budget && ((budget->cpu_limit
+                                && clock_ns (clocks [n]) - cpu [n] > budget->cpu_limit)
+                           || (budget->wall_limit
+                                && now - progress [n] > budget->wall_limit))) {
+                budget->exceeded [n] = 1;
+            } else {
+                continue;
+            }
+
+            err = restart (sb, n);
+            check (err == 0, "Failed to restart worker of player %s.", gs->names [n]);
+            active [n] = 0;
+            remaining--;
+        }
+        if (remaining == 0) break;
+
+        __atomic_store_n (&sb->shared->waiting, 1, __ATOMIC_SEQ_CST);
+        futex_wait (&sb->shared->bell, bell, &ts);
+        __atomic_store_n (&sb->shared->waiting, 0, __ATOMIC_RELAXED);
+    }
+
+    return 0;
+
+error:
+    return 1;
+}
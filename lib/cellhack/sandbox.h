@@ -0,0 +1,90 @@
+// Copyright 2015 Marvin Poul
+// Licensed under the Do What The Fuck You Want To License, Version 2
+// See LICENSE for details or http://www.wtfpl.net/txt/copying
+
+#ifndef SANDBOX_H
+#define SANDBOX_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "cellhack.h"
+
+// number of slots in every player's ring
+#define SANDBOX_SLOTS 8
+
+/* One batch of cells on its way to a worker process and back */
+typedef struct {
+    uint32_t count;
+    uint8_t env [CELLHACK_CHUNK][9];
+    uint8_t energy [CELLHACK_CHUNK];
+    uint64_t memory [CELLHACK_CHUNK];
+    uint8_t action [CELLHACK_CHUNK];
+} SandboxSlot;
+
+/* Single producer (engine), single consumer (worker) ring of slots, head and
+ * done only ever grow and double as futex words */
+typedef struct {
+    // slots filled by the engine
+    uint32_t head;
+    // slots finished by the worker
+    uint32_t done;
+    // set while the worker sleeps on head
+    uint32_t waiting;
+    // set to have the worker time its player
+    int profile;
+    // decisions the worker answered from and missed its decision cache, over
+    // all restarts
+    uint64_t hits;
+    uint64_t misses;
+    // time of every call of the player if profile is set, over all restarts
+    ProfileHist decisions;
+    SandboxSlot slots [SANDBOX_SLOTS];
+} __attribute__ ((aligned (64))) SandboxRing;
+
+/* Shared between the engine and all workers */
+typedef struct {
+    // bumped by the workers whenever they finished a slot
+    uint32_t bell;
+    // set while the engine sleeps on bell
+    uint32_t waiting;
+} SandboxShared;
+
+typedef struct Sandbox {
+    int num;
+    pid_t *pids;
+    CellHack_decide_action *ai;
+    CellHack_decide_actions_batch *batch_ai;
+    // set for players whose workers cache their decisions
+    uint8_t *pure;
+    SandboxShared *shared;
+    // one mapping per player, a worker unmaps the rings of all other players
+    // so it cannot touch their cells
+    SandboxRing **rings;
+    // the engine's own copy of every ring's head and of the number of cells
+    // in each of its slots, slot s of player n at counts [n * SANDBOX_SLOTS +
+    // s], since workers can write anything to their rings
+    uint32_t *heads;
+    uint32_t *counts;
+} Sandbox;
+
+/* Forks one worker process for each of the num players, worker n runs
+ * batch_ai [n] on whole slots if not NULL and ai [n] on every cell otherwise;
+ * if pure is not NULL, workers of players with pure [n] set keep a decision
+ * cache
+ */
+Sandbox *Sandbox_create (int num, CellHack_decide_action *ai,
+                         CellHack_decide_actions_batch *batch_ai, const int *pure);
+
+/* Kills all workers and frees the sandbox */
+void Sandbox_destroy (Sandbox *sb);
+
+/* Decides the actions of all cells in gs's work list by shipping them to the
+ * workers of their players.
+ * If budget is not NULL, players that use more CPU time than allowed in it or
+ * that block for longer than its wall limit are killed and restarted, their
+ * remaining cells do nothing. Players whose worker crashes are restarted the
+ * same way.
+ * returns 0 on success, 1 on error */
+int Sandbox_run (Sandbox *sb, GameState *gs, ExecutorBudget *budget);
+#endif
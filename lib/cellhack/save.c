@@ -0,0 +1,652 @@
+// Copyright 2015 Marvin Poul
+// Licensed under the Do What The Fuck You Want To License, Version 2
+// See LICENSE for details or http://www.wtfpl.net/txt/copying
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "dbg.h"
+#include "save.h"
+
+// fixed part of the version 2 header, before the meta text
+#define SAVE_HEADER_SIZE 40
+// kind, raw_size and packed_size of every frame
+#define SAVE_FRAME_HEADER_SIZE 9
+// a run is only worth it from this many equal bytes on
+#define SAVE_MIN_RUN 4
+// number of cells compared at once while looking for changes
+#define SAVE_BLOCK 32
+
+static int start_writer (Save *save);
+
+static inline uint8_t *
+put_u32 (uint8_t *dst, uint32_t v)
+{
+    int i;
+    for (i = 0; i < 4; i++) dst [i] = v >> (8 * i);
+    return dst + 4;
+}
+
+static inline uint8_t *
+put_u64 (uint8_t *dst, uint64_t v)
+{
+    int i;
+    for (i = 0; i < 8; i++) dst [i] = v >> (8 * i);
+    return dst + 8;
+}
+
+/* Writes size bytes of buf to the replay file and counts them
+ * returns 0 on success, 1 on error */
+static inline int
+put (Save *save, const void *buf, size_t size)
+{
+    if (fwrite (buf, 1, size, save->file) != size) return 1;
+    __atomic_add_fetch (&save->bytes, size, __ATOMIC_RELAXED);
+    return 0;
+}
+
+size_t
+Save_put_varint (uint8_t *dst, uint64_t v)
+{
+    size_t n = 0;
+
+    while (v >= 0x80) {
+        dst [n++] = (v & 0x7f) | 0x80;
+        v >>= 7;
+    }
+    dst [n++] = v;
+
+    return n;
+}
+
+size_t
+Save_get_varint (const uint8_t *src, size_t size, uint64_t *v)
+{
+    size_t n;
+    int shift = 0;
+
+    *v = 0;
+    for (n = 0; n < size && shift < 64; n++, shift += 7) {
+        *v |= (uint64_t) (src [n] & 0x7f) << shift;
+        if (!(src [n] & 0x80)) return n + 1;
+    }
+
+    return 0;
+}
+
+size_t
+Save_pack (uint8_t *dst, const uint8_t *src, size_t size)
+{
+    size_t i = 0, literal = 0, run, out = 0;
+
+    while (i < size) {
+        for (run = 1; i + run < size && src [i + run] == src [i]; run++);
+
+        if (run < SAVE_MIN_RUN) {
+            i += run;
+            continue;
+        }
+
+        out += Save_put_varint (dst + out, i - literal);
+        memcpy (dst + out, src + literal, i - literal);
+        out += i - literal;
+        out += Save_put_varint (dst + out, run);
+        dst [out++] = src [i];
+
+        i += run;
+        literal = i;
+    }
+
+    out += Save_put_varint (dst + out, size - literal);
+    memcpy (dst + out, src + literal, size - literal);
+    out += size - literal;
+    out += Save_put_varint (dst + out, 0);
+
+    return out;
+}
+
+size_t
+Save_unpack (uint8_t *dst, size_t capacity, const uint8_t *src, size_t size)
+{
+    size_t pos = 0, out = 0, n;
+    uint64_t literal, run;
+
+    while (pos < size) {
+        n = Save_get_varint (src + pos, size - pos, &literal);
+        if (n == 0) return (size_t) -1;
+        pos += n;
+        if (literal > size - pos || literal > capacity - out) return (size_t) -1;
+        memcpy (dst + out, src + pos, literal);
+        pos += literal;
+        out += literal;
+
+        n = Save_get_varint (src + pos, size - pos, &run);
+        if (n == 0) return (size_t) -1;
+        pos += n;
+        if (run == 0) continue;
+        if (pos >= size || run > capacity - out) return (size_t) -1;
+        memset (dst + out, src [pos++], run);
+        out += run;
+    }
+
+    return out;
+}
+
+/* returns the size of a keyframe's unpacked payload */
+static inline size_t
+keyframe_size (const Save *save)
+{
+    return save->cells * (((save->options.fields & SAVE_TYPE)   ? 1 : 0)
+                        + ((save->options.fields & SAVE_ENERGY) ? 1 : 0)
+                        + ((save->options.fields & SAVE_MEMORY) ? 8 : 0));
+}
+
+/* Writes the meta text (the whole header of version 1) into a fresh buffer
+ * returns the buffer or NULL on error, its size goes to *size */
+static char *
+meta_text (int width, int height, int num, char **names, size_t *size)
+{
+    char *text = NULL;
+    FILE *stream = NULL;
+    int i;
+
+    stream = open_memstream (&text, size);
+    check (stream != NULL, "Failed to open replay header buffer.");
+
+    fprintf (stream, "width: %i\n", width);
+    fprintf (stream, "height: %i\n", height);
+    fprintf (stream, "players: ");
+    for (i = 0; i < num - 1; i++) {
+        fprintf (stream, "%s, ", names [i]);
+    }
+    fprintf (stream, "%s\n", names [num - 1]);
+    fputc ('\0', stream);
+    check (fclose (stream) == 0, "Failed to write replay header buffer.");
+
+    return text;
+
+error:
+    if (text) free (text);
+    return NULL;
+}
+
+Save *
+Save_create (FILE *file, int width, int height, int num, char **names,
+             const SaveOptions *options)
+{
+    Save *save = NULL;
+    SaveOptions defaults = {
+        .version   = 2,
+        .fields    = SAVE_ALL,
+        .keyframes = SAVE_KEYFRAME_INTERVAL
+    };
+    uint8_t header [SAVE_HEADER_SIZE], *p;
+    char *meta = NULL;
+    size_t meta_size;
+    int err;
+    check (file != NULL, "Got NULL as replay file.");
+    check (num > 0, "Need at least one player.");
+
+    save = calloc (1, sizeof (Save));
+    check (save != NULL, "Failed to alloc replay writer.");
+
+    save->file    = file;
+    save->options = options ? *options : defaults;
+    save->cells   = width * height;
+    check (save->options.version == 1 || save->options.version == 2,
+           "Unknown replay version %i.", save->options.version);
+    check ((save->options.fields & SAVE_ALL) != 0 && (save->options.fields & ~SAVE_ALL) == 0,
+           "Invalid set of replay fields.");
+    if (save->options.keyframes == 0) save->options.keyframes = SAVE_KEYFRAME_INTERVAL;
+
+    meta = meta_text (width, height, num, names, &meta_size);
+    check (meta != NULL, "Failed to format replay header.");
+
+    if (save->options.version == 1) {
+        err = put (save, meta, meta_size);
+        check (err == 0, "Failed to write replay header.");
+
+        // frames are staged in raw
+        save->raw = malloc (save->cells * sizeof (SaveFormat));
+        check (save->raw != NULL, "Failed to alloc frame buffer.");
+
+        free (meta);
+        meta = NULL;
+        if (save->options.buffers > 0) {
+            err = start_writer (save);
+            check (err == 0, "Failed to start replay writer.");
+        }
+        return save;
+    }
+
+    memcpy (header, SAVE_MAGIC, 8);
+    p = put_u32 (header + 8, 2);
+    p = put_u32 (p, SAVE_HEADER_SIZE + meta_size);
+    p = put_u32 (p, width);
+    p = put_u32 (p, height);
+    p = put_u32 (p, num);
+    p = put_u32 (p, save->options.fields);
+    p = put_u32 (p, save->options.keyframes);
+    p = put_u32 (p, meta_size);
+
+    err = put (save, header, SAVE_HEADER_SIZE);
+    check (err == 0, "Failed to write replay header.");
+    err = put (save, meta, meta_size);
+    check (err == 0, "Failed to write replay header.");
+    save->offset = SAVE_HEADER_SIZE + meta_size;
+    free (meta);
+    meta = NULL;
+
+    save->types = calloc (save->cells, sizeof (uint8_t));
+    check (save->types != NULL, "Failed to alloc last frame's types.");
+    save->energies = calloc (save->cells, sizeof (uint8_t));
+    check (save->energies != NULL, "Failed to alloc last frame's energies.");
+    save->memories = calloc (save->cells, sizeof (uint64_t));
+    check (save->memories != NULL, "Failed to alloc last frame's memories.");
+
+    // deltas that would get bigger than a keyframe are given up on before
+    // they run over
+    save->raw_size = keyframe_size (save);
+    save->raw = malloc (save->raw_size + SAVE_FRAME_HEADER_SIZE);
+    check (save->raw != NULL, "Failed to alloc frame buffer.");
+    save->packed = malloc (Save_packed_bound (save->raw_size) + SAVE_FRAME_HEADER_SIZE);
+    check (save->packed != NULL, "Failed to alloc packed frame buffer.");
+
+    if (save->options.buffers > 0) {
+        err = start_writer (save);
+        check (err == 0, "Failed to start replay writer.");
+    }
+
+    return save;
+
+error:
+    if (meta) free (meta);
+    if (save) save->file = NULL;
+    if (file) fclose (file);
+    Save_destroy (save);
+    return NULL;
+}
+
+/* Puts the full planes into save->raw and remembers them
+ * returns the payload's size */
+static size_t
+encode_keyframe (Save *save, const uint8_t *types, const uint8_t *energies,
+                 const uint64_t *memories)
+{
+    uint8_t *raw = save->raw;
+    unsigned int i;
+    int b;
+
+    if (save->options.fields & SAVE_TYPE) {
+        memcpy (raw, types, save->cells);
+        memcpy (save->types, types, save->cells);
+        raw += save->cells;
+    }
+    if (save->options.fields & SAVE_ENERGY) {
+        memcpy (raw, energies, save->cells);
+        memcpy (save->energies, energies, save->cells);
+        raw += save->cells;
+    }
+    if (save->options.fields & SAVE_MEMORY) {
+        for (b = 0; b < 8; b++) {
+            for (i = 0; i < save->cells; i++) {
+                raw [i] = memories [i] >> (8 * b);
+            }
+            raw += save->cells;
+        }
+        memcpy (save->memories, memories, save->cells * sizeof (uint64_t));
+    }
+
+    return raw - save->raw;
+}
+
+/* Puts the cells that changed since the last frame into save->raw and
+ * remembers them
+ * returns the payload's size or 0 if it would not be smaller than a keyframe,
+ * in which case nothing is remembered */
+static size_t
+encode_delta (Save *save, const uint8_t *types, const uint8_t *energies,
+              const uint64_t *memories)
+{
+    int fields = save->options.fields;
+    // room for the count in front and one more cell at the end
+    size_t start = 10, pos = start, limit = save->raw_size - 20, n;
+    unsigned int i, block, end, changed = 0;
+    long last = -1;
+    uint8_t count [10];
+
+    if (save->raw_size < 30) return 0;
+
+    for (block = 0; block < save->cells; block += SAVE_BLOCK) {
+        end = block + SAVE_BLOCK < save->cells ? block + SAVE_BLOCK : save->cells;
+
+        if ((!(fields & SAVE_TYPE)
+                || memcmp (types + block, save->types + block, end - block) == 0)
+            && (!(fields & SAVE_ENERGY)
+                || memcmp (energies + block, save->energies + block, end - block) == 0)
+            && (!(fields & SAVE_MEMORY)
+                || memcmp (memories + block, save->memories + block,
+                           (end - block) * sizeof (uint64_t)) == 0)) {
+            continue;
+        }
+
+        for (i = block; i < end; i++) {
+            if (!((fields & SAVE_TYPE) && types [i] != save->types [i])
+                && !((fields & SAVE_ENERGY) && energies [i] != save->energies [i])
+                && !((fields & SAVE_MEMORY) && memories [i] != save->memories [i])) {
+                continue;
+            }
+            if (pos > limit) return 0;
+
+            pos += Save_put_varint (save->raw + pos, i - last);
+            if (fields & SAVE_TYPE)   save->raw [pos++] = types [i];
+            if (fields & SAVE_ENERGY) save->raw [pos++] = energies [i];
+            if (fields & SAVE_MEMORY) pos += Save_put_varint (save->raw + pos, memories [i]);
+            last = i;
+            changed++;
+        }
+    }
+
+    // only now that the delta is known to be used, remember the new planes
+    if (fields & SAVE_TYPE)   memcpy (save->types, types, save->cells);
+    if (fields & SAVE_ENERGY) memcpy (save->energies, energies, save->cells);
+    if (fields & SAVE_MEMORY) {
+        memcpy (save->memories, memories, save->cells * sizeof (uint64_t));
+    }
+
+    n = Save_put_varint (count, changed);
+    memmove (save->raw + n, save->raw + start, pos - start);
+    memcpy (save->raw, count, n);
+
+    return pos - start + n;
+}
+
+/* Appends a version 1 frame */
+static int
+frame_v1 (Save *save, const uint8_t *types, const uint8_t *energies,
+          const uint64_t *memories)
+{
+    SaveFormat *buf = (SaveFormat *) save->raw;
+    unsigned int i;
+    int err;
+
+    for (i = 0; i < save->cells; i++) {
+        buf [i].player = types [i];
+        buf [i].energy = energies [i];
+        buf [i].memory = memories [i];
+    }
+    err = put (save, buf, save->cells * sizeof (SaveFormat));
+    check (err == 0, "Failed to write cell state to file.");
+
+    save->frames++;
+    return 0;
+
+error:
+    return 1;
+}
+
+/* Encodes and appends a frame, on the writer thread if there is one
+ * returns 0 on success, 1 on error */
+static int
+write_frame (Save *save, const uint8_t *types, const uint8_t *energies,
+             const uint64_t *memories)
+{
+    uint8_t kind = SAVE_DELTA, *p;
+    size_t raw = 0, packed;
+    unsigned int size;
+    uint32_t *frames;
+    uint64_t *offsets;
+    int err;
+
+    if (save->options.version == 1) return frame_v1 (save, types, energies, memories);
+
+    if (save->frames % save->options.keyframes != 0) {
+        raw = encode_delta (save, types, energies, memories);
+    }
+    if (raw == 0) {
+        kind = SAVE_KEYFRAME;
+        raw = encode_keyframe (save, types, energies, memories);
+    }
+
+    if (kind == SAVE_KEYFRAME) {
+        if (save->keys == save->keys_size) {
+            size = save->keys_size ? 2 * save->keys_size : 64;
+            frames = realloc (save->key_frames, size * sizeof (uint32_t));
+            check (frames != NULL, "Failed to grow keyframe index.");
+            save->key_frames = frames;
+            offsets = realloc (save->key_offsets, size * sizeof (uint64_t));
+            check (offsets != NULL, "Failed to grow keyframe index.");
+            save->key_offsets = offsets;
+            save->keys_size = size;
+        }
+        save->key_frames [save->keys]  = save->frames;
+        save->key_offsets [save->keys] = save->offset;
+        save->keys++;
+    }
+
+    packed = Save_pack (save->packed + SAVE_FRAME_HEADER_SIZE, save->raw, raw);
+    save->packed [0] = kind;
+    p = put_u32 (save->packed + 1, raw);
+    put_u32 (p, packed);
+
+    err = put (save, save->packed, packed + SAVE_FRAME_HEADER_SIZE);
+    check (err == 0, "Failed to write frame to file.");
+
+    save->offset += packed + SAVE_FRAME_HEADER_SIZE;
+    save->frames++;
+    return 0;
+
+error:
+    return 1;
+}
+
+/* returns the current monotonic time in nanoseconds */
+static inline uint64_t
+clock_ns (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Main loop of the writer thread, writes queued snapshots in order until the
+ * writer is shut down and nothing is left */
+static void *
+Writer (Save *save)
+{
+    SaveSnapshot *snap;
+    int err;
+
+    pthread_mutex_lock (&save->lock);
+    while (1) {
+        while (save->written == save->queued && !save->shutdown) {
+            pthread_cond_wait (&save->filled, &save->lock);
+        }
+        if (save->written == save->queued) break;
+
+        // the snapshot is ours until written is bumped
+        snap = save->snapshots + save->written % save->options.buffers;
+        pthread_mutex_unlock (&save->lock);
+        err = save->failed ? 1 : write_frame (save, snap->types, snap->energies,
+                                              snap->memories);
+        pthread_mutex_lock (&save->lock);
+
+        if (err) save->failed = 1;
+        save->written++;
+        pthread_cond_signal (&save->drained);
+    }
+    pthread_mutex_unlock (&save->lock);
+
+    return NULL;
+}
+
+/* Allocates the snapshots and starts the writer thread
+ * returns 0 on success, 1 on error */
+static int
+start_writer (Save *save)
+{
+    SaveSnapshot *snap;
+    unsigned int i;
+    int err, v1 = save->options.version == 1, fields = save->options.fields;
+
+    save->snapshots = calloc (save->options.buffers, sizeof (SaveSnapshot));
+    check (save->snapshots != NULL, "Failed to alloc replay snapshots.");
+
+    // only the recorded planes are copied
+    for (i = 0; i < save->options.buffers; i++) {
+        snap = save->snapshots + i;
+        if (v1 || (fields & SAVE_TYPE)) {
+            snap->types = malloc (save->cells * sizeof (uint8_t));
+            check (snap->types != NULL, "Failed to alloc replay snapshot.");
+        }
+        if (v1 || (fields & SAVE_ENERGY)) {
+            snap->energies = malloc (save->cells * sizeof (uint8_t));
+            check (snap->energies != NULL, "Failed to alloc replay snapshot.");
+        }
+        if (v1 || (fields & SAVE_MEMORY)) {
+            snap->memories = malloc (save->cells * sizeof (uint64_t));
+            check (snap->memories != NULL, "Failed to alloc replay snapshot.");
+        }
+    }
+
+    err = pthread_mutex_init (&save->lock, NULL);
+    check (err == 0, "Failed to init replay writer lock.");
+    err = pthread_cond_init (&save->filled, NULL);
+    check (err == 0, "Failed to init replay writer condition.");
+    err = pthread_cond_init (&save->drained, NULL);
+    check (err == 0, "Failed to init replay writer condition.");
+
+    err = pthread_create (&save->writer, NULL, (void *(*) (void *)) Writer, save);
+    check (err == 0, "Failed to start replay writer thread.");
+    save->writer_running = 1;
+
+    return 0;
+
+error:
+    return 1;
+}
+
+int
+Save_frame (Save *save, const uint8_t *types, const uint8_t *energies,
+            const uint64_t *memories)
+{
+    SaveSnapshot *snap;
+    uint64_t start;
+    int failed;
+    check (save != NULL, "Got NULL as replay writer.");
+
+    if (!save->writer_running) {
+        if (save->failed || write_frame (save, types, energies, memories)) {
+            save->failed = 1;
+            return 1;
+        }
+        return 0;
+    }
+
+    pthread_mutex_lock (&save->lock);
+    if (save->queued - save->written == save->options.buffers) {
+        start = clock_ns ();
+        while (save->queued - save->written == save->options.buffers) {
+            pthread_cond_wait (&save->drained, &save->lock);
+        }
+        __atomic_add_fetch (&save->stall, clock_ns () - start, __ATOMIC_RELAXED);
+    }
+    failed = save->failed;
+    pthread_mutex_unlock (&save->lock);
+    check (!failed, "Replay writer failed to write a frame.");
+
+    // nobody else touches the snapshot until queued is bumped
+    snap = save->snapshots + save->queued % save->options.buffers;
+    if (snap->types)    memcpy (snap->types, types, save->cells * sizeof (uint8_t));
+    if (snap->energies) memcpy (snap->energies, energies, save->cells * sizeof (uint8_t));
+    if (snap->memories) memcpy (snap->memories, memories, save->cells * sizeof (uint64_t));
+
+    pthread_mutex_lock (&save->lock);
+    save->queued++;
+    pthread_cond_signal (&save->filled);
+    pthread_mutex_unlock (&save->lock);
+
+    return 0;
+
+error:
+    return 1;
+}
+
+/* Writes the keyframe index and the footer
+ * returns 0 on success, 1 on error */
+static int
+finish (Save *save)
+{
+    uint8_t buf [12], *p;
+    unsigned int i;
+    int err;
+
+    put_u32 (buf, save->keys);
+    err = put (save, buf, 4);
+    check (err == 0, "Failed to write keyframe index.");
+
+    for (i = 0; i < save->keys; i++) {
+        p = put_u32 (buf, save->key_frames [i]);
+        put_u64 (p, save->key_offsets [i]);
+        err = put (save, buf, 12);
+        check (err == 0, "Failed to write keyframe index.");
+    }
+
+    p = put_u64 (buf, save->offset);
+    put_u32 (p, save->frames);
+    err = put (save, buf, 12);
+    check (err == 0, "Failed to write replay footer.");
+    err = put (save, SAVE_FOOTER_MAGIC, 4);
+    check (err == 0, "Failed to write replay footer.");
+
+    return 0;
+
+error:
+    return 1;
+}
+
+int
+Save_destroy (Save *save)
+{
+    unsigned int i;
+    int err = 0;
+    if (!save) return 0;
+
+    if (save->writer_running) {
+        pthread_mutex_lock (&save->lock);
+        save->shutdown = 1;
+        pthread_cond_signal (&save->filled);
+        pthread_mutex_unlock (&save->lock);
+        pthread_join (save->writer, NULL);
+
+        pthread_cond_destroy (&save->drained);
+        pthread_cond_destroy (&save->filled);
+        pthread_mutex_destroy (&save->lock);
+    }
+
+    if (save->failed) err = 1;
+    if (save->file) {
+        // an index written after a frame that is missing or cut short would
+        // make a broken replay look complete
+        if (save->options.version == 2 && !save->failed) err |= finish (save);
+        if (fclose (save->file) != 0) err = 1;
+    }
+
+    if (save->types)    free (save->types);
+    if (save->energies) free (save->energies);
+    if (save->memories) free (save->memories);
+    if (save->raw)      free (save->raw);
+    if (save->packed)   free (save->packed);
+    if (save->key_frames)  free (save->key_frames);
+    if (save->key_offsets) free (save->key_offsets);
+    for (i = 0; save->snapshots && i < save->options.buffers; i++) {
+        if (save->snapshots [i].types)    free (save->snapshots [i].types);
+        if (save->snapshots [i].energies) free (save->snapshots [i].energies);
+        if (save->snapshots [i].memories) free (save->snapshots [i].memories);
+    }
+    if (save->snapshots) free (save->snapshots);
+    free (save);
+
+    return err;
+}
@@ -0,0 +1,191 @@
+// Copyright 2015 Marvin Poul
+// Licensed under the Do What The Fuck You Want To License, Version 2
+// See LICENSE for details or http://www.wtfpl.net/txt/copying
+
+#ifndef SAVE_H
+#define SAVE_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* Replay files come in two versions.
+ *
+ * Version 1 is a text header
+ *  > width: integer
+ *  > height: integer
+ *  > players: first_player, second_player, …
+ *  > \000
+ * followed by one frame per turn of width * height SaveFormats, without any
+ * delimiter between them.
+ *
+ * Version 2 is a binary header, all integers are little endian
+ *  > magic       8 bytes, SAVE_MAGIC
+ *  > version     u32, 2
+ *  > header_size u32, offset of the first frame
+ *  > width       u32
+ *  > height      u32
+ *  > players     u32
+ *  > fields      u32, SAVE_* flags of the recorded planes
+ *  > keyframes   u32, a keyframe is written at least every that many frames
+ *  > meta_size   u32
+ *  > meta        the version 1 text header, including its \000
+ * followed by one frame per turn
+ *  > kind        u8, SAVE_KEYFRAME or SAVE_DELTA
+ *  > raw_size    u32, size of the frame's payload once unpacked
+ *  > packed_size u32
+ *  > payload     packed_size bytes, packed with Save_pack
+ * and the index of all keyframes
+ *  > count       u32
+ *  > count times frame (u32) and file offset (u64) of the keyframe
+ * with a footer in the last SAVE_FOOTER_SIZE bytes of the file
+ *  > index       u64, offset of the index
+ *  > frames      u32
+ *  > magic       4 bytes, SAVE_FOOTER_MAGIC
+ *
+ * A keyframe's payload holds the full recorded planes one after the other:
+ * the type plane, the energy plane and the memory plane as eight byte planes,
+ * least significant byte first. A delta holds only the cells in which any
+ * recorded plane differs from the previous frame: their number, then for each
+ * of them the distance to the previous one's index (the first one's index
+ * plus one) as varint followed by its type and energy byte and its memory as
+ * varint, each only if recorded.
+ *
+ * Packed payloads are a sequence of literal stretches and runs: varint n,
+ * n literal bytes, varint m and, if m is not 0, one byte repeated m times.
+ * Varints store seven bits per byte, least significant group first, the
+ * high bit is set on every byte but the last. */
+
+#define SAVE_MAGIC "CHREPLAY"
+#define SAVE_FOOTER_MAGIC "CHRI"
+#define SAVE_FOOTER_SIZE 16
+
+#define SAVE_TYPE   1
+#define SAVE_ENERGY 2
+#define SAVE_MEMORY 4
+#define SAVE_ALL    (SAVE_TYPE | SAVE_ENERGY | SAVE_MEMORY)
+
+#define SAVE_KEYFRAME 0
+#define SAVE_DELTA    1
+
+// default distance between two keyframes
+#define SAVE_KEYFRAME_INTERVAL 100
+
+/* one cell of a version 1 frame */
+typedef struct __attribute__ ((packed)) {
+    uint8_t player;
+    uint8_t energy;
+    uint64_t memory;
+} SaveFormat;
+
+typedef struct {
+    // 1 or 2
+    int version;
+    // SAVE_* flags of the planes to record, version 2 only
+    int fields;
+    // frames between two keyframes, version 2 only
+    unsigned int keyframes;
+    // number of frames that may wait for a writer thread, which encodes and
+    // writes them in the background; 0 to write every frame right away
+    unsigned int buffers;
+} SaveOptions;
+
+/* Copy of the planes of one frame on its way to the writer thread */
+typedef struct {
+    uint8_t *types;
+    uint8_t *energies;
+    uint64_t *memories;
+} SaveSnapshot;
+
+typedef struct {
+    FILE *file;
+    SaveOptions options;
+    unsigned int cells;
+    // number of frames written so far
+    unsigned int frames;
+    // file offset of the next frame
+    uint64_t offset;
+    // planes of the last frame, deltas are taken against them
+    uint8_t *types;
+    uint8_t *energies;
+    uint64_t *memories;
+    // unpacked and packed payload of the current frame
+    uint8_t *raw;
+    size_t raw_size;
+    uint8_t *packed;
+    // frame and file offset of every keyframe
+    uint32_t *key_frames;
+    uint64_t *key_offsets;
+    unsigned int keys;
+    unsigned int keys_size;
+    // options.buffers snapshots, frame n goes to snapshots [n % buffers];
+    // queued only ever grows and counts the frames handed to the writer,
+    // written those it is done with
+    SaveSnapshot *snapshots;
+    unsigned long queued;
+    unsigned long written;
+    pthread_t writer;
+    int writer_running;
+    pthread_mutex_t lock;
+    // signaled when a snapshot was queued or the writer should stop
+    pthread_cond_t filled;
+    // signaled when the writer is done with a snapshot
+    pthread_cond_t drained;
+    int shutdown;
+    // set once a frame failed to be written, by the writer or by Save_frame
+    int failed;
+    // bytes written to the file so far
+    uint64_t bytes;
+    // nanoseconds Save_frame spent waiting for the writer to free a snapshot
+    uint64_t stall;
+} Save;
+
+#define Save_bytes(save) __atomic_load_n (&(save)->bytes, __ATOMIC_RELAXED)
+#define Save_stall(save) __atomic_load_n (&(save)->stall, __ATOMIC_RELAXED)
+
+/* Writes the header of a replay to file and returns the writer for its frames
+ * width, height    size of the playing field
+ * num              number of players on the field
+ * names            their names in the order that corresponds to the values of
+ *                  cell type value (names [0] -> type = 1, …)
+ * options          format to write, NULL for version 2 with all planes
+ * Takes ownership of file, it is closed by Save_destroy or right away if
+ * Save_create fails. */
+Save *Save_create (FILE *file, int width, int height, int num, char **names,
+                   const SaveOptions *options);
+
+/* Appends the cells' planes as the next frame
+ * With a writer thread the planes are only copied and the call blocks only
+ * if all buffers are still waiting to be written; a failure of the writer
+ * shows up in the next call.
+ * returns 0 on success, 1 on error */
+int Save_frame (Save *save, const uint8_t *types, const uint8_t *energies,
+                const uint64_t *memories);
+
+/* Waits for the writer thread to write all queued frames, writes the keyframe
+ * index and footer unless a frame failed to be written, closes the file and
+ * frees the writer
+ * returns 0 on success, 1 if a frame failed or the file could not be finished */
+int Save_destroy (Save *save);
+
+/* Packs size bytes of src into dst, which must hold at least
+ * Save_packed_bound (size) bytes
+ * returns the packed size */
+size_t Save_pack (uint8_t *dst, const uint8_t *src, size_t size);
+
+/* Unpacks size bytes of src into dst, which holds at most capacity bytes
+ * returns the unpacked size or (size_t) -1 if src is malformed or does not
+ * fit */
+size_t Save_unpack (uint8_t *dst, size_t capacity, const uint8_t *src, size_t size);
+
+/* Writes v as varint to dst, returns the number of bytes written (at most
+ * 10) */
+size_t Save_put_varint (uint8_t *dst, uint64_t v);
+
+/* Reads a varint from src, which holds size bytes, into *v
+ * returns the number of bytes read or 0 if src ends before the varint */
+size_t Save_get_varint (const uint8_t *src, size_t size, uint64_t *v);
+
+// worst case size of size bytes once packed
+#define Save_packed_bound(size) ((size) + (size) / 1024 + 16)
+#endif
@@ -0,0 +1,71 @@
+// Copyright 2015 Marvin Poul
+// Licensed under the Do What The Fuck You Want To License, Version 2
+// See LICENSE for details or http://www.wtfpl.net/txt/copying
+
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#include "dbg.h"
+#include "scratch.h"
+
+Scratch *
+Scratch_create (size_t size, int huge)
+{
+    Scratch *s = NULL;
+    int err;
+
+    s = calloc (1, sizeof (Scratch));
+    check (s != NULL, "Failed to alloc scratch arena.");
+
+    size = (size + SCRATCH_ALIGN - 1) & ~(size_t) (SCRATCH_ALIGN - 1);
+    if (huge && size >= SCRATCH_HUGE_PAGE) {
+        size = (size + SCRATCH_HUGE_PAGE - 1) & ~(SCRATCH_HUGE_PAGE - 1);
+        s->base = mmap (NULL, size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        check (s->base != MAP_FAILED, "Failed to map scratch arena.");
+        s->mapped = 1;
+#ifdef MADV_HUGEPAGE
+        // only a hint, the arena works just as well with normal pages
+        if (madvise (s->base, size, MADV_HUGEPAGE) != 0) {
+            debug ("Scratch arena is not backed by huge pages.");
+        }
+#endif
+    } else {
+        err = posix_memalign ((void **) &s->base, SCRATCH_ALIGN, size);
+        check (err == 0, "Failed to alloc scratch arena.");
+    }
+    s->size = size;
+
+    return s;
+
+error:
+    if (s && s->base == MAP_FAILED) s->base = NULL;
+    Scratch_destroy (s);
+    return NULL;
+}
+
+void
+Scratch_destroy (Scratch *s)
+{
+    if (!s) return;
+
+    if (s->base && s->mapped) {
+        munmap (s->base, s->size);
+    } else if (s->base) {
+        free (s->base);
+    }
+    free (s);
+}
+
+void *
+Scratch_alloc (Scratch *s, size_t bytes)
+{
+    void *p;
+
+    bytes = (bytes + SCRATCH_ALIGN - 1) & ~(size_t) (SCRATCH_ALIGN - 1);
+    if (bytes > s->size - s->used) return NULL;
+
+    p = s->base + s->used;
+    s->used += bytes;
+    return p;
+}
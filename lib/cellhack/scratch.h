@@ -0,0 +1,37 @@
+// Copyright 2015 Marvin Poul
+// Licensed under the Do What The Fuck You Want To License, Version 2
+// See LICENSE for details or http://www.wtfpl.net/txt/copying
+
+#ifndef SCRATCH_H
+#define SCRATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// alignment of every allocation from a scratch arena
+#define SCRATCH_ALIGN 64
+// arenas at least this big are mapped in huge page sized units
+#define SCRATCH_HUGE_PAGE (2ul << 20)
+
+/* Bump allocator over one block of memory that is allocated once, nothing is
+ * freed on its own, everything goes with the arena */
+typedef struct {
+    uint8_t *base;
+    size_t size;
+    size_t used;
+    // 1 if base is an anonymous mapping, 0 if it came from the heap
+    int mapped;
+} Scratch;
+
+/* Allocates an arena of size bytes
+ * If huge is set and the arena is big enough, it is mapped and the kernel is
+ * asked to back it with transparent huge pages. */
+Scratch *Scratch_create (size_t size, int huge);
+
+/* Frees the arena and everything allocated from it */
+void Scratch_destroy (Scratch *s);
+
+/* returns bytes bytes of uninitialized memory aligned to SCRATCH_ALIGN or
+ * NULL if the arena has no room left */
+void *Scratch_alloc (Scratch *s, size_t bytes);
+#endif